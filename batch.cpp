@@ -0,0 +1,120 @@
+// A fixed set of threads that run one job at a time: run() hands the job to every thread, which gets its own index,
+// and waits until all of them are done with it.
+struct thread_pool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::function<void(size_t)> job;
+    uint64_t generation = 0; // of the current job
+    size_t busy = 0;
+    bool stopping = false;
+    
+    thread_pool(size_t count)
+    {
+        for(size_t i = 0; i < count; i++)
+            threads.emplace_back([this, i] { work(i); });
+    }
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(auto & thread : threads)
+            thread.join();
+    }
+    thread_pool(const thread_pool &) = delete;
+    thread_pool & operator=(const thread_pool &) = delete;
+    
+    void work(size_t index)
+    {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true)
+        {
+            wake.wait(lock, [&] { return stopping or generation != seen; });
+            if(stopping)
+                return;
+            seen = generation;
+            lock.unlock();
+            job(index);
+            lock.lock();
+            if(--busy == 0)
+                done.notify_all();
+        }
+    }
+    
+    void run(std::function<void(size_t)> function)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        job = std::move(function);
+        busy = threads.size();
+        generation++;
+        wake.notify_all();
+        done.wait(lock, [&] { return busy == 0; });
+    }
+};
+
+// Lays out many cues at once across a thread pool. Every worker shapes with its own buffer, its own shape cache and
+// its own hb_font_create_sub_font of each size, all over the context's shared faces; the context itself is only read.
+// Nothing gets rasterized here: that goes through freetype, which isn't thread safe, and happens when the cues are drawn.
+struct shape_batch {
+    struct worker {
+        shape_cache shapes;
+        shape_state state {&shapes, true};
+    };
+    
+    render_context & ctx;
+    std::vector<worker *> workers;
+    thread_pool pool;
+    size_t chunk = 16; // cues a worker takes at a time
+    
+    // threads: 0 for one per core
+    shape_batch(render_context & ctx, size_t threads = 0) : ctx(ctx), pool(threads ? threads : macro_max(std::thread::hardware_concurrency(), 1u))
+    {
+        for(size_t i = 0; i < pool.threads.size(); i++)
+            workers.push_back(new worker);
+    }
+    ~shape_batch()
+    {
+        for(auto worker : workers)
+            delete worker;
+    }
+    shape_batch(const shape_batch &) = delete;
+    shape_batch & operator=(const shape_batch &) = delete;
+    
+    // out[i] is texts[i] laid out, as by the subtitle constructor
+    void layout(const std::vector<std::string_view> & texts, float size, int mode, std::vector<subtitle> & out)
+    {
+        out.clear();
+        out.resize(texts.size());
+        if(!ctx.initialized)
+            return;
+        
+        // workers segment again and find the same fonts already open, so they never load one themselves
+        std::vector<bool> used(ctx.fonts.size(), false);
+        used[0] = true;
+        std::vector<run_span> spans;
+        for(const auto & text : texts)
+        {
+            segment_runs(ctx, (const uint8_t *)text.data(), text.size(), mode, spans);
+            for(const auto & span : spans)
+                used[span.font] = true;
+        }
+        ctx.preload(size_from_pixels(size), used);
+        
+        std::atomic<size_t> next(0);
+        pool.run([&](size_t index)
+        {
+            auto & state = workers[index]->state;
+            size_t first;
+            while((first = next.fetch_add(chunk)) < texts.size())
+            {
+                for(size_t i = first; i < first + chunk and i < texts.size(); i++)
+                    out[i].layout(ctx, state, (const uint8_t *)texts[i].data(), texts[i].size(), size, mode);
+            }
+        });
+    }
+};
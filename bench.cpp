@@ -0,0 +1,817 @@
+#include <chrono>
+
+// Microbenchmarks: vertjp --bench [corpus]. The corpus is utf-8 text; without one, a built-in sample of subtitle
+// dialogue is repeated to about a megabyte.
+
+const char * bench_sample =
+    u8"「お前、本当にそれでいいのか？」\n"
+    u8"いいも何も、もう決めたことだから。\n"
+    u8"（ドアの閉まる音）\n"
+    u8"明日の朝９時、東京駅の新幹線ホームで待ってる。\n"
+    u8"ＵＳＢメモリは3本、全部で128GBある。\n"
+    u8"ねえ……聞いてる？　ちゃんと返事して！\n"
+    u8"♪～ 君の声が聞こえる 遠い空の向こうから ～♪\n"
+    u8"第２話「はじまりの日」\n"
+    u8"えっ、マジで!? 信じられない……\n"
+    u8"ちょっと待って、ＮＨＫのニュースでも言ってたよ。\n"
+    u8"ハァ…ハァ…　間に合った！\n"
+    u8"この件はＡ社のＣＥＯに直接話すべきだ。\n";
+
+std::string bench_corpus(const char * filename)
+{
+    std::string text;
+    if(filename)
+    {
+        mapped_file file;
+        if(map_file(filename, file))
+        {
+            text.assign((const char *)file.data, file.size);
+            unmap_file(file);
+            return text;
+        }
+        printf("failed to open corpus %s, using the built-in sample\n", filename);
+    }
+    while(text.size() < 1000000)
+        text += bench_sample;
+    return text;
+}
+
+std::vector<uint32_t> bench_codepoints(const std::string & text)
+{
+    std::vector<uint32_t> codepoints(text.size());
+    size_t count = 0;
+    utf8_decode_bulk((const uint8_t *)text.data(), text.size(), codepoints.data(), &count, UNISHIM_REPLACE_INVALID);
+    codepoints.resize(count);
+    return codepoints;
+}
+
+// best of several runs, in seconds
+template<typename F>
+double bench_time(F && function, int runs = 5)
+{
+    double best = 1e30;
+    for(int i = 0; i < runs; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = macro_min(best, elapsed.count());
+    }
+    return best;
+}
+
+// whether two layouts came out glyph for glyph the same
+bool bench_same_layout(const subtitle & a, const subtitle & b)
+{
+    if(a.glyphs != b.glyphs or a.fonts != b.fonts or a.clusters != b.clusters or a.positions.size() != b.positions.size())
+        return false;
+    if(a.minx != b.minx or a.miny != b.miny or a.maxx != b.maxx or a.maxy != b.maxy)
+        return false;
+    return a.positions.empty() or memcmp(a.positions.data(), b.positions.data(), a.positions.size()*sizeof(posdata)) == 0;
+}
+
+void bench_report(const char * name, double seconds, size_t count, const char * unit)
+{
+    printf("%-40s %10.3f ms %10.2f ns/%s\n", name, seconds*1000.0, seconds*1e9/macro_max(count, 1), unit);
+}
+
+void bench_orientation(const render_context & ctx, const std::vector<uint32_t> & text)
+{
+    // the lookup as it was before the two-stage table: map probes, then a linear scan over the ranges
+    auto data = fopen(ORIENTATION_FILE, "rb");
+    if(!data)
+    {
+        puts("orientation: " ORIENTATION_FILE " not found, skipping comparison with the old lookup");
+        return;
+    }
+    auto lines = read_lines(data);
+    fclose(data);
+    std::vector<rule_range> ranges;
+    std::map<uint32_t, int8_t> singles;
+    parse_lines(lines, ranges, singles);
+    auto old_orientation = [&](uint32_t codepoint) -> int8_t
+    {
+        if(singles.count(codepoint) == 1)
+            return singles[codepoint];
+        for(const auto & range : ranges)
+        {
+            if(codepoint >= range.first and codepoint <= range.final)
+                return range.orientation;
+        }
+        return 1;
+    };
+    
+    size_t mismatches = 0;
+    for(auto codepoint : text)
+        mismatches += old_orientation(codepoint) != ctx.orientations.get(codepoint);
+    
+    volatile int sink = 0;
+    auto old_time = bench_time([&]
+    {
+        int sum = 0;
+        for(auto codepoint : text)
+            sum += old_orientation(codepoint);
+        sink = sum;
+    });
+    auto new_time = bench_time([&]
+    {
+        int sum = 0;
+        for(auto codepoint : text)
+            sum += ctx.orientations.get(codepoint);
+        sink = sum;
+    });
+    (void)sink;
+    bench_report("orientation: map + range scan", old_time, text.size(), "codepoint");
+    bench_report("orientation: two-stage table", new_time, text.size(), "codepoint");
+    if(mismatches)
+        printf("orientation: %zu codepoints disagree with the old lookup!\n", mismatches);
+}
+
+void bench_segmentation(render_context & ctx, const std::string & text, const std::vector<uint32_t> & codepoints)
+{
+    // segmentation as the subtitle constructor used to do it: inside the decode callback, one vector per run
+    struct textrun {
+        std::vector<uint32_t> text;
+        bool rotated;
+        uint16_t font;
+    };
+    struct segmenter {
+        render_context & ctx;
+        std::vector<textrun> runs;
+    };
+    volatile size_t sink = 0;
+    auto old_time = bench_time([&]
+    {
+        segmenter state {ctx, {{{}, false, 0}}};
+        utf8_iterate((uint8_t *)text.data(), text.size(), [](uint32_t codepoint, UNISHIM_PUN_TYPE * userdata) -> int
+        {
+            auto & state = *(segmenter *)userdata;
+            auto & runs = state.runs;
+            auto font = state.ctx.font_for(codepoint, runs.back().font);
+            auto rotate = state.ctx.fonts[font]->rotates(codepoint);
+            if(rotate != runs.back().rotated or font != runs.back().font)
+            {
+                if(runs.back().text.size() == 0)
+                    runs.pop_back();
+                runs.push_back({{codepoint}, rotate, font});
+            }
+            else
+                runs.back().text.push_back(codepoint);
+            return 0;
+        }, &state);
+        sink = state.runs.size();
+    });
+    // the same loop, decoding through the templated iterator so the body can be inlined
+    auto inlined_time = bench_time([&]
+    {
+        std::vector<textrun> runs {{{}, false, 0}};
+        utf8_iterate((const uint8_t *)text.data(), text.size(), [&](uint32_t codepoint) -> int
+        {
+            auto font = ctx.font_for(codepoint, runs.back().font);
+            auto rotate = ctx.fonts[font]->rotates(codepoint);
+            if(rotate != runs.back().rotated or font != runs.back().font)
+            {
+                if(runs.back().text.size() == 0)
+                    runs.pop_back();
+                runs.push_back({{codepoint}, rotate, font});
+            }
+            else
+                runs.back().text.push_back(codepoint);
+            return 0;
+        });
+        sink = runs.size();
+    });
+    // and just the decode + classification, without building runs
+    auto callback_classify_time = bench_time([&]
+    {
+        struct classifier {
+            render_context & ctx;
+            uint16_t font;
+            size_t rotated;
+        } state {ctx, 0, 0};
+        utf8_iterate((uint8_t *)text.data(), text.size(), [](uint32_t codepoint, UNISHIM_PUN_TYPE * userdata) -> int
+        {
+            auto & state = *(classifier *)userdata;
+            state.font = state.ctx.font_for(codepoint, state.font);
+            state.rotated += state.ctx.fonts[state.font]->rotates(codepoint);
+            return 0;
+        }, &state);
+        sink = state.rotated;
+    });
+    auto inlined_classify_time = bench_time([&]
+    {
+        uint16_t font = 0;
+        size_t rotated = 0;
+        utf8_iterate((const uint8_t *)text.data(), text.size(), [&](uint32_t codepoint) -> int
+        {
+            font = ctx.font_for(codepoint, font);
+            rotated += ctx.fonts[font]->rotates(codepoint);
+            return 0;
+        });
+        sink = rotated;
+    });
+    std::vector<run_span> spans;
+    auto new_time = bench_time([&]
+    {
+        segment_runs(ctx, codepoints.data(), codepoints.size(), 1, spans);
+        sink = spans.size();
+    });
+    // decode + segment_runs, against segmenting the utf-8 directly into byte spans
+    std::vector<uint32_t> decoded(text.size());
+    auto decode_time = bench_time([&]
+    {
+        size_t count = 0;
+        utf8_decode_bulk((const uint8_t *)text.data(), text.size(), decoded.data(), &count, UNISHIM_REPLACE_INVALID);
+        segment_runs(ctx, decoded.data(), count, 1, spans);
+        sink = spans.size();
+    });
+    auto utf8_time = bench_time([&]
+    {
+        segment_runs(ctx, (const uint8_t *)text.data(), text.size(), 1, spans);
+        sink = spans.size();
+    });
+    (void)sink;
+    bench_report("segmentation: decode callback + vectors", old_time, codepoints.size(), "codepoint");
+    bench_report("segmentation: inlined decode + vectors", inlined_time, codepoints.size(), "codepoint");
+    bench_report("classify: callback decode", callback_classify_time, codepoints.size(), "codepoint");
+    bench_report("classify: inlined decode", inlined_classify_time, codepoints.size(), "codepoint");
+    bench_report("segmentation: segment_runs", new_time, codepoints.size(), "codepoint");
+    bench_report("segmentation: bulk decode + segment_runs", decode_time, codepoints.size(), "codepoint");
+    bench_report("segmentation: segment_runs on utf-8", utf8_time, codepoints.size(), "codepoint");
+}
+
+void bench_utf8(const std::string & text, size_t count)
+{
+    std::vector<uint32_t> codepoints;
+    auto old_time = bench_time([&]
+    {
+        codepoints.clear();
+        utf8_iterate((uint8_t *)text.data(), text.size(), [](uint32_t codepoint, UNISHIM_PUN_TYPE * userdata) -> int
+        {
+            ((std::vector<uint32_t> *)userdata)->push_back(codepoint);
+            return 0;
+        }, &codepoints);
+    });
+    std::vector<uint32_t> bulk(text.size());
+    size_t bulk_count = 0;
+    auto new_time = bench_time([&]
+    {
+        utf8_decode_bulk((const uint8_t *)text.data(), text.size(), bulk.data(), &bulk_count, 0);
+    });
+    std::string ascii(text.size(), ' ');
+    for(size_t i = 0; i < ascii.size(); i++)
+        ascii[i] = 'a' + i%26;
+    auto ascii_old_time = bench_time([&]
+    {
+        codepoints.clear();
+        utf8_iterate((uint8_t *)ascii.data(), ascii.size(), [](uint32_t codepoint, UNISHIM_PUN_TYPE * userdata) -> int
+        {
+            ((std::vector<uint32_t> *)userdata)->push_back(codepoint);
+            return 0;
+        }, &codepoints);
+    });
+    auto ascii_new_time = bench_time([&]
+    {
+        utf8_decode_bulk((const uint8_t *)ascii.data(), ascii.size(), bulk.data(), &bulk_count, 0);
+    });
+    bench_report("utf-8: utf8_iterate + push_back", old_time, count, "codepoint");
+    bench_report("utf-8: utf8_decode_bulk", new_time, count, "codepoint");
+    bench_report("utf-8 (ascii): utf8_iterate + push_back", ascii_old_time, ascii.size(), "codepoint");
+    bench_report("utf-8 (ascii): utf8_decode_bulk", ascii_new_time, ascii.size(), "codepoint");
+}
+
+// callback vs templated iteration over each encoding, summing codepoints so the loop can't be thrown away
+void bench_iteration(const std::string & text, const std::vector<uint32_t> & codepoints)
+{
+    std::vector<uint16_t> utf16;
+    for(auto codepoint : codepoints)
+    {
+        if(codepoint >= 0x10000)
+        {
+            utf16.push_back(0xD800 + ((codepoint - 0x10000) >> 10));
+            utf16.push_back(0xDC00 + ((codepoint - 0x10000) & 0x3FF));
+        }
+        else
+            utf16.push_back(codepoint);
+    }
+    auto utf32 = codepoints;
+    
+    auto sum = [](uint32_t codepoint, UNISHIM_PUN_TYPE * userdata) -> int
+    {
+        *(uint64_t *)userdata += codepoint;
+        return 0;
+    };
+    volatile uint64_t sink = 0;
+    uint64_t total = 0;
+    
+    auto utf8_callback = bench_time([&] { total = 0; utf8_iterate((uint8_t *)text.data(), text.size(), sum, &total); sink = total; });
+    auto utf8_inlined = bench_time([&] { total = 0; utf8_iterate((const uint8_t *)text.data(), text.size(), [&](uint32_t codepoint) -> int { total += codepoint; return 0; }); sink = total; });
+    auto utf16_callback = bench_time([&] { total = 0; utf16_iterate(utf16.data(), utf16.size(), sum, &total); sink = total; });
+    auto utf16_inlined = bench_time([&] { total = 0; utf16_iterate((const uint16_t *)utf16.data(), utf16.size(), [&](uint32_t codepoint) -> int { total += codepoint; return 0; }); sink = total; });
+    auto utf32_callback = bench_time([&] { total = 0; utf32_iterate(utf32.data(), utf32.size(), sum, &total); sink = total; });
+    auto utf32_inlined = bench_time([&] { total = 0; utf32_iterate((const uint32_t *)utf32.data(), utf32.size(), [&](uint32_t codepoint) -> int { total += codepoint; return 0; }); sink = total; });
+    (void)sink;
+    
+    bench_report("iterate utf-8: callback", utf8_callback, codepoints.size(), "codepoint");
+    bench_report("iterate utf-8: template", utf8_inlined, codepoints.size(), "codepoint");
+    bench_report("iterate utf-16: callback", utf16_callback, codepoints.size(), "codepoint");
+    bench_report("iterate utf-16: template", utf16_inlined, codepoints.size(), "codepoint");
+    bench_report("iterate utf-32: callback", utf32_callback, codepoints.size(), "codepoint");
+    bench_report("iterate utf-32: template", utf32_inlined, codepoints.size(), "codepoint");
+}
+
+// the corpus's non-empty lines, up to 5000 of them
+std::vector<std::string_view> bench_lines(const std::string & text)
+{
+    std::vector<std::string_view> lines;
+    for(size_t start = 0; start < text.size() and lines.size() < 5000;)
+    {
+        auto end = text.find('\n', start);
+        if(end == std::string::npos)
+            end = text.size();
+        if(end > start)
+            lines.push_back(std::string_view(text).substr(start, end - start));
+        start = end + 1;
+    }
+    return lines;
+}
+
+// lays out each line of the corpus as a subtitle, with and without the shaped-run cache
+void bench_shaping(render_context & ctx, const std::string & text)
+{
+    auto lines = bench_lines(text);
+    
+    volatile size_t sink = 0;
+    auto layout_all = [&]
+    {
+        for(auto line : lines)
+            sink = subtitle(ctx, line, FONTSIZE, 1).glyphs.size();
+    };
+    
+    auto capacity = ctx.shapes.capacity;
+    ctx.shapes.clear();
+    ctx.shapes.capacity = 0;
+    auto uncached_time = bench_time(layout_all);
+    ctx.shapes.capacity = capacity;
+    ctx.shapes.hits = ctx.shapes.misses = ctx.shapes.evictions = 0;
+    auto cached_time = bench_time(layout_all);
+    (void)sink;
+    
+    bench_report("layout: shaping every run", uncached_time, lines.size(), "line");
+    bench_report("layout: shaped-run cache", cached_time, lines.size(), "line");
+    printf("shaped-run cache: %llu hits, %llu misses, %llu evictions, %zu entries\n",
+        (unsigned long long)ctx.shapes.hits, (unsigned long long)ctx.shapes.misses, (unsigned long long)ctx.shapes.evictions, ctx.shapes.entries.size());
+}
+
+// vertical cues that keep switching between upright kana and rotated latin, laid out with every run shaped on its own
+// and with single-pass shaping; the shape cache is off so that every run really gets shaped
+void bench_mixed(render_context & ctx)
+{
+    const char * cues[] = {
+        u8"次はShibuya、Shibuyaです。The next station is Shibuya.",
+        u8"このPCはWindows 11で、RAMは16GBです",
+        u8"ライブのチケットはweb限定、price は ¥5,000 です",
+        u8"えっと、Wi-Fiのpasswordって何だっけ？",
+        u8"Track 3「Blue Moon」feat. ミナミ",
+        u8"OK、じゃあplan Bでいこう。Ready?",
+    };
+    std::vector<std::string> lines;
+    for(int i = 0; i < 500; i++)
+        lines.push_back(cues[i % (sizeof(cues)/sizeof(cues[0]))] + std::to_string(i));
+    
+    volatile size_t sink = 0;
+    auto layout_all = [&]
+    {
+        for(const auto & line : lines)
+            sink = subtitle(ctx, line, FONTSIZE, 1).glyphs.size();
+    };
+    
+    auto capacity = ctx.shapes.capacity;
+    auto single_pass = ctx.single_pass;
+    ctx.shapes.clear();
+    ctx.shapes.capacity = 0;
+    ctx.single_pass = false;
+    auto per_run_time = bench_time(layout_all);
+    ctx.single_pass = true;
+    auto single_pass_time = bench_time(layout_all);
+    
+    // both ways have to come out the same
+    size_t mismatches = 0;
+    for(const auto & line : lines)
+    {
+        ctx.single_pass = false;
+        auto per_run = subtitle(ctx, line, FONTSIZE, 1);
+        ctx.single_pass = true;
+        auto combined = subtitle(ctx, line, FONTSIZE, 1);
+        mismatches += !bench_same_layout(per_run, combined);
+    }
+    ctx.shapes.capacity = capacity;
+    ctx.single_pass = single_pass;
+    (void)sink;
+    
+    bench_report("mixed cues: one hb call per run", per_run_time, lines.size(), "line");
+    bench_report("mixed cues: single-pass shaping", single_pass_time, lines.size(), "line");
+    printf("mixed cues: %zu of %zu lines laid out differently\n", mismatches, lines.size());
+}
+
+// lays out the corpus lines one after another on the calling thread, then all at once with a shape_batch;
+// both start with empty shape caches, and the batch's results have to come back the same and in order
+void bench_batch(render_context & ctx, const std::string & text)
+{
+    auto lines = bench_lines(text);
+    
+    std::vector<subtitle> serial;
+    auto serial_time = bench_time([&]
+    {
+        ctx.shapes.clear();
+        serial.clear();
+        for(auto line : lines)
+            serial.emplace_back(ctx, line, FONTSIZE, 1);
+    });
+    
+    shape_batch batch(ctx);
+    std::vector<subtitle> batched;
+    auto batch_time = bench_time([&]
+    {
+        for(auto worker : batch.workers)
+            worker->shapes.clear();
+        batch.layout(lines, FONTSIZE, 1, batched);
+    });
+    
+    size_t mismatches = 0;
+    for(size_t i = 0; i < lines.size(); i++)
+        mismatches += !bench_same_layout(serial[i], batched[i]);
+    
+    bench_report("layout: one line at a time", serial_time, lines.size(), "line");
+    char name[64];
+    snprintf(name, sizeof(name), "layout: shape_batch, %zu threads", batch.workers.size());
+    bench_report(name, batch_time, lines.size(), "line");
+    printf("shape_batch: %zu of %zu lines laid out differently\n", mismatches, lines.size());
+}
+
+// bounds of each corpus line from measure_text, and from laying the line out as a subtitle
+void bench_measure(render_context & ctx, const std::string & text)
+{
+    auto lines = bench_lines(text);
+    
+    volatile int sink = 0;
+    auto measure_time = bench_time([&]
+    {
+        for(auto line : lines)
+            sink = measure_text(ctx, line, FONTSIZE, 1).width();
+    });
+    auto layout_time = bench_time([&]
+    {
+        for(auto line : lines)
+            sink = subtitle(ctx, line, FONTSIZE, 1).maxx;
+    });
+    (void)sink;
+    
+    size_t mismatches = 0;
+    for(auto line : lines)
+    {
+        auto extents = measure_text(ctx, line, FONTSIZE, 1);
+        auto sub = subtitle(ctx, line, FONTSIZE, 1);
+        mismatches += extents.minx != sub.minx or extents.miny != sub.miny or extents.maxx != sub.maxx or extents.maxy != sub.maxy;
+    }
+    
+    bench_report("measure: measure_text", measure_time, lines.size(), "line");
+    bench_report("measure: subtitle layout", layout_time, lines.size(), "line");
+    printf("measure: %zu of %zu lines measured differently\n", mismatches, lines.size());
+}
+
+// lays the corpus lines out once, then wraps them into columns of several heights, against laying them out again
+void bench_wrap(render_context & ctx, const std::string & text)
+{
+    auto lines = bench_lines(text);
+    std::vector<subtitle> subs;
+    auto layout_time = bench_time([&]
+    {
+        subs.clear();
+        for(auto line : lines)
+            subs.emplace_back(ctx, line, FONTSIZE, 1);
+    });
+    
+    const float heights[] = {4, 6, 8, 12};
+    size_t columns = 0;
+    auto wrap_time = bench_time([&]
+    {
+        columns = 0;
+        for(auto height : heights)
+        {
+            for(auto & sub : subs)
+            {
+                sub.wrap(height*FONTSIZE);
+                columns += sub.line_starts.size() + 1;
+            }
+        }
+    });
+    
+    bench_report("wrap: layout", layout_time, lines.size(), "line");
+    bench_report("wrap: rewrap at 4 heights", wrap_time, lines.size()*4, "wrap");
+    printf("wrap: %.2f columns per line on average\n", double(columns)/macro_max(lines.size()*4, 1));
+}
+
+// cues with furigana, laid out as one annotated subtitle, and the old way as a subtitle for the text and one per
+// annotation (before any compositing)
+void bench_ruby(render_context & ctx)
+{
+    std::string_view text = u8"明日の朝、東京駅の新幹線ホームで待ってる。";
+    std::vector<ruby_span> ruby;
+    const char * readings[][2] = {{u8"明日", u8"あした"}, {u8"朝", u8"あさ"}, {u8"東京駅", u8"とうきょうえき"}, {u8"新幹線", u8"しんかんせん"}, {u8"待", u8"ま"}};
+    for(auto reading : readings)
+        ruby.push_back({uint32_t(text.find(reading[0])), uint32_t(strlen(reading[0])), reading[1]});
+    
+    volatile size_t sink = 0;
+    auto separate_time = bench_time([&]
+    {
+        for(int i = 0; i < 500; i++)
+        {
+            sink = subtitle(ctx, text, FONTSIZE, 1).glyphs.size();
+            for(const auto & span : ruby)
+                sink = subtitle(ctx, span.text, FONTSIZE*RUBY_SCALE, 1).glyphs.size();
+        }
+    });
+    size_t glyph_count = 0;
+    auto annotated_time = bench_time([&]
+    {
+        for(int i = 0; i < 500; i++)
+            glyph_count = subtitle(ctx, text, ruby, FONTSIZE, 1).glyphs.size();
+    });
+    (void)sink;
+    
+    bench_report("ruby: text and annotations separately", separate_time, 500, "cue");
+    bench_report("ruby: one annotated subtitle", annotated_time, 500, "cue");
+    printf("ruby: %zu glyphs per annotated cue\n", glyph_count);
+}
+
+// fits corpus lines into a 1280x200 box in horizontal text and a 300x400 box in vertical text with columns, the
+// old way (a subtitle per size tried, from the biggest down) and with fit_size
+void bench_fit(render_context & ctx, const std::string & text)
+{
+    auto lines = bench_lines(text);
+    if(lines.size() > 200)
+        lines.resize(200);
+    
+    struct box {
+        float width, height;
+        int mode;
+    };
+    const box boxes[] = {{1280, 200, 0}, {300, 400, 1}};
+    
+    auto fits = [&](const subtitle & sub, const box & area)
+    {
+        return sub.maxx - sub.minx <= area.width and sub.maxy - sub.miny <= area.height;
+    };
+    
+    std::vector<float> stepped;
+    auto stepped_time = bench_time([&]
+    {
+        stepped.clear();
+        for(const auto & area : boxes)
+        {
+            for(auto line : lines)
+            {
+                int size = 128;
+                for(; size > 8; size--)
+                {
+                    subtitle sub(ctx, line, size, area.mode);
+                    if(area.mode == 1)
+                        sub.wrap(area.height);
+                    if(fits(sub, area))
+                        break;
+                }
+                stepped.push_back(size);
+            }
+        }
+    }, 1);
+    std::vector<float> searched;
+    auto search_time = bench_time([&]
+    {
+        searched.clear();
+        for(const auto & area : boxes)
+        {
+            for(auto line : lines)
+                searched.push_back(fit_size(ctx, line, area.width, area.height, area.mode, area.mode == 1, 8, 128));
+        }
+    }, 1);
+    
+    size_t differences = 0;
+    for(size_t i = 0; i < stepped.size(); i++)
+        differences += stepped[i] != searched[i];
+    
+    bench_report("fit: subtitle per size tried", stepped_time, stepped.size(), "cue");
+    bench_report("fit: fit_size", search_time, searched.size(), "cue");
+    printf("fit: %zu of %zu cues got a different size\n", differences, stepped.size());
+}
+
+// looks up every glyph of the laid out corpus in the glyph cache once it's warm, against a std::map of the same keys
+void bench_glyph_cache(render_context & ctx, const std::string & text)
+{
+    auto lines = bench_lines(text);
+    std::vector<uint64_t> keys;
+    std::vector<subtitle> subs;
+    for(auto line : lines)
+    {
+        subs.emplace_back(ctx, line, FONTSIZE, 1);
+        const auto & sub = subs.back();
+        sub.load_glyphs(ctx);
+        for(size_t i = 0; i < sub.glyphs.size(); i++)
+            keys.push_back(glyph_key(sub.fonts[i], sub.glyph_size(i), sub.glyphs[i], sub.modes[i]));
+    }
+    std::map<uint64_t, glyph *> tree;
+    for(auto key : keys)
+        tree[key] = ctx.cache.find(key).value;
+    
+    volatile size_t sink = 0;
+    auto table_time = bench_time([&]
+    {
+        for(const auto & sub : subs)
+        {
+            for(size_t i = 0; i < sub.glyphs.size(); i++)
+                sink = (size_t)ctx.get_glyph(sub.fonts[i], sub.glyph_size(i), sub.glyphs[i], sub.modes[i]);
+        }
+    });
+    auto tree_time = bench_time([&]
+    {
+        for(auto key : keys)
+            sink = (size_t)tree[key];
+    });
+    (void)sink;
+    
+    bench_report("glyph cache: std::map", tree_time, keys.size(), "glyph");
+    bench_report("glyph cache: open addressing", table_time, keys.size(), "glyph");
+    printf("glyph cache: %zu glyphs in %zu slots\n", ctx.cache.count, ctx.cache.slots.size());
+}
+
+// draws every corpus line at a few sizes, one frame per line, with the glyph cache held to a quarter of what that
+// needs unbounded, and reports what eviction did
+void bench_glyph_budget(render_context & ctx, const std::string & text)
+{
+    auto lines = bench_lines(text);
+    std::vector<subtitle> subs;
+    for(float scale : {1.0f, 1.5f, 2.0f})
+    {
+        for(auto line : lines)
+            subs.emplace_back(ctx, line, FONTSIZE*scale, 1);
+    }
+    
+    auto & cache = ctx.cache;
+    auto draw_all = [&]
+    {
+        for(const auto & sub : subs)
+        {
+            auto frame = cache.begin_frame();
+            sub.load_glyphs(ctx);
+            cache.end_frame(frame);
+        }
+    };
+    cache.clear();
+    draw_all();
+    size_t unbounded = cache.bytes;
+    
+    auto old_budget = cache.budget;
+    cache.budget = unbounded/4;
+    cache.clear();
+    cache.hits = cache.misses = cache.evictions = 0;
+    auto time = bench_time(draw_all, 1);
+    bench_report("glyph cache: drawing under a budget", time, subs.size(), "cue");
+    printf("glyph cache: %zu of %zu bytes budgeted, %zu glyphs, %llu hits, %llu misses, %llu evictions\n",
+        cache.bytes, cache.budget, cache.count, (unsigned long long)cache.hits, (unsigned long long)cache.misses,
+        (unsigned long long)cache.evictions);
+    cache.budget = old_budget;
+}
+
+// types corpus lines in one codepoint at a time, rebuilding a subtitle on every keystroke and then following along
+// with an editable_subtitle; then edits the middle of each line and checks it against a fresh layout
+void bench_typing(render_context & ctx, const std::string & text)
+{
+    auto lines = bench_lines(text);
+    std::vector<std::vector<uint32_t>> typed;
+    size_t keystrokes = 0;
+    for(size_t i = 0; i < lines.size() and typed.size() < 200; i++)
+    {
+        typed.push_back(bench_codepoints(std::string(lines[i])));
+        keystrokes += typed.back().size();
+    }
+    
+    volatile size_t sink = 0;
+    auto rebuild_time = bench_time([&]
+    {
+        for(const auto & line : typed)
+        {
+            for(size_t n = 1; n <= line.size(); n++)
+                sink = subtitle(ctx, line.data(), n, FONTSIZE, 1).glyphs.size();
+        }
+    });
+    uint64_t reshaped = 0;
+    auto edit_time = bench_time([&]
+    {
+        reshaped = 0;
+        for(const auto & line : typed)
+        {
+            editable_subtitle editable(ctx, FONTSIZE, 1);
+            for(size_t n = 0; n < line.size(); n++)
+                editable.append(&line[n], 1);
+            sink = editable.sub.glyphs.size();
+            reshaped += editable.reshaped;
+        }
+    });
+    (void)sink;
+    
+    size_t mismatches = 0;
+    const uint32_t inserted[] = {'A', 0x3042, 0x300C};
+    for(const auto & line : typed)
+    {
+        editable_subtitle editable(ctx, FONTSIZE, 1);
+        editable.assign(line.data(), line.size());
+        size_t middle = line.size()/2;
+        editable.replace(middle, 1, inserted, 3);
+        editable.erase(0, 1);
+        auto expected = editable.text;
+        mismatches += !bench_same_layout(editable.sub, subtitle(ctx, expected.data(), expected.size(), FONTSIZE, 1));
+    }
+    
+    bench_report("typing: new subtitle per keystroke", rebuild_time, keystrokes, "key");
+    bench_report("typing: editable_subtitle", edit_time, keystrokes, "key");
+    printf("typing: %.2f codepoints reshaped per keystroke, %zu of %zu edited lines laid out differently\n",
+        double(reshaped)/macro_max(keystrokes, 1), mismatches, typed.size());
+}
+
+// types and backspaces at the end of ever longer cues; with only a window around each edit reshaped, the time per
+// keystroke should stay about the same however long the cue gets
+void bench_long_cue(render_context & ctx, const std::vector<uint32_t> & codepoints)
+{
+    if(codepoints.empty())
+        return;
+    const size_t typed = 64;
+    for(size_t length : {100, 400, 1600, 6400})
+    {
+        std::vector<uint32_t> cue;
+        while(cue.size() < length + typed)
+            cue.insert(cue.end(), codepoints.begin(), codepoints.begin() + macro_min(codepoints.size(), length + typed - cue.size()));
+        
+        editable_subtitle editable(ctx, FONTSIZE, 1);
+        editable.assign(cue.data(), length);
+        auto time = bench_time([&]
+        {
+            editable.reshaped = 0;
+            for(size_t n = length; n < length + typed; n++)
+                editable.append(&cue[n], 1);
+            for(size_t n = 0; n < typed; n++)
+                editable.erase(editable.text.size() - 1, 1);
+        });
+        char name[64];
+        snprintf(name, sizeof(name), "long cue: %zu codepoints", length);
+        bench_report(name, time, typed*2, "key");
+        printf("long cue: %.2f codepoints reshaped per keystroke\n", double(editable.reshaped)/(typed*2));
+    }
+}
+
+// What the primary font's derived tables cost on a first run, each on a freshly opened face, against viewing them from
+// the snapshot on later runs. The metrics are most of it: they need every glyph's ink extents, so every outline (every
+// CFF charstring, in a CID font) gets read once.
+void bench_tables(render_context & ctx)
+{
+    auto primary = ctx.fonts[0];
+    render_font fresh[3];
+    for(auto & font : fresh)
+        font.load(ctx.freetype, primary->hbblob);
+    
+    auto metrics_time = bench_time([&] { fresh[0].metrics.own(collect_metrics(fresh[0].hbfont, fresh[0].glyph_count)); }, 1);
+    auto build_time = bench_time([&] { fresh[1].build_tables(ctx.orientations); }, 1);
+    bool loaded = false;
+    auto snapshot_time = bench_time([&] { loaded = load_snapshot(fresh[2], nullptr, ctx.data_hash); }, 1);
+    for(auto & font : fresh)
+        font.unload();
+    
+    bench_report("tables: first run, metrics alone", metrics_time, primary->glyph_count, "glyph");
+    bench_report("tables: first run, all of them", build_time, primary->glyph_count, "glyph");
+    if(loaded)
+        bench_report("tables: later runs, from the snapshot", snapshot_time, primary->glyph_count, "glyph");
+}
+
+int run_benchmarks(render_context & ctx, const char * corpusfile)
+{
+    auto text = bench_corpus(corpusfile);
+    auto codepoints = bench_codepoints(text);
+    printf("corpus: %zu bytes, %zu codepoints\n", text.size(), codepoints.size());
+    
+    bench_tables(ctx);
+    bench_utf8(text, codepoints.size());
+    bench_iteration(text, codepoints);
+    bench_orientation(ctx, codepoints);
+    bench_segmentation(ctx, text, codepoints);
+    bench_shaping(ctx, text);
+    bench_mixed(ctx);
+    bench_batch(ctx, text);
+    bench_typing(ctx, text);
+    bench_long_cue(ctx, codepoints);
+    bench_measure(ctx, text);
+    bench_wrap(ctx, text);
+    bench_ruby(ctx);
+    bench_fit(ctx, text);
+    bench_glyph_cache(ctx, text);
+    bench_glyph_budget(ctx, text);
+    return 0;
+}
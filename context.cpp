@@ -0,0 +1,883 @@
+#include "include/freetype/ftsizes.h"
+
+struct render_font;
+struct sized_font;
+
+struct glyph
+{
+    sprite * image = nullptr;
+    int w, h, x, y;
+    uint64_t index = 0;
+    glyph(render_font & font, sized_font & sized, const uint32_t & glyphindex, int mode);
+    ~glyph()
+    {
+        if(image != nullptr)
+            delete image;
+    }
+};
+
+// everything a rasterized glyph depends on, packed into one word; font is the position in the fallback chain, and
+// glyph ids only go up to 65535 in opentype
+uint64_t glyph_key(uint16_t font, int32_t size, hb_codepoint_t index, int mode)
+{
+    return uint64_t(uint32_t(size)) | uint64_t(index & 0xFFFF) << 32 | uint64_t(font & 0x3FFF) << 48 | uint64_t(mode & 3) << 62;
+}
+
+// Rasterized glyphs, in a flat open-addressed table (linear probing, at most half full). A lookup is one probe
+// sequence that ends either at the glyph or at the empty slot it goes in, so a miss can be filled without looking again.
+// The table keeps its glyphs under a byte budget, evicting with CLOCK: a hand sweeps the slots, sparing (once) glyphs
+// used since it last passed and always sparing glyphs pinned by a frame still in flight (see begin_frame).
+struct glyph_table {
+    struct slot {
+        uint64_t key;
+        glyph * value; // nullptr: empty
+        uint64_t frame; // the last frame that used it, or 0
+        bool referenced; // used since the hand last passed
+    };
+    std::vector<slot> slots;
+    size_t hand = 0;
+    
+    size_t budget = 64<<20; // bytes
+    size_t bytes = 0;
+    size_t count = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    
+    uint64_t last_frame = 0;
+    std::vector<uint64_t> frames; // in flight
+    
+    glyph_table()
+    {
+        slots.assign(256, {0, nullptr, 0, false});
+    }
+    ~glyph_table()
+    {
+        clear();
+    }
+    glyph_table(const glyph_table &) = delete;
+    glyph_table & operator=(const glyph_table &) = delete;
+    
+    static size_t hash(uint64_t key)
+    {
+        // murmur3's finalizer; the low bits pick the slot, so they need to depend on all of the key
+        key ^= key >> 33;
+        key *= 0xFF51AFD7ED558CCDull;
+        key ^= key >> 33;
+        key *= 0xC4CEB9FE1A85EC53ull;
+        key ^= key >> 33;
+        return key;
+    }
+    static size_t glyph_bytes(const glyph * value)
+    {
+        return sizeof(glyph) + (value->image ? value->image->bytes() : 0);
+    }
+    
+    // Glyphs used from here until end_frame with the frame returned are pinned: nothing evicts them while the frame is
+    // in flight, so a frame can look up all of its glyphs first and use them later. Frames can overlap.
+    uint64_t begin_frame()
+    {
+        frames.push_back(++last_frame);
+        return last_frame;
+    }
+    void end_frame(uint64_t frame)
+    {
+        for(size_t i = 0; i < frames.size(); i++)
+        {
+            if(frames[i] == frame)
+            {
+                frames.erase(frames.begin() + i);
+                break;
+            }
+        }
+        evict();
+    }
+    bool pinned(const slot & entry) const
+    {
+        // a frame that used it is at least as new as the oldest one in flight
+        for(auto frame : frames)
+        {
+            if(entry.frame >= frame)
+                return true;
+        }
+        return false;
+    }
+    
+    // the glyph's slot, or the empty one it would go in
+    slot & find(uint64_t key)
+    {
+        size_t mask = slots.size() - 1;
+        for(size_t i = hash(key) & mask; ; i = (i + 1) & mask)
+        {
+            if(!slots[i].value or slots[i].key == key)
+                return slots[i];
+        }
+    }
+    
+    // marks a slot find returned full as used, and hands out its glyph
+    glyph * use(slot & entry)
+    {
+        hits++;
+        entry.referenced = true;
+        if(frames.size())
+            entry.frame = last_frame;
+        return entry.value;
+    }
+    
+    // fills a slot find returned empty; the slot can't be used afterwards, since evicting or growing moves things, but
+    // the glyph stays until it's evicted some later time
+    void fill(slot & empty, uint64_t key, glyph * value)
+    {
+        misses++;
+        empty = {key, value, frames.size() ? last_frame : 0, true};
+        bytes += glyph_bytes(value);
+        count++;
+        evict(key);
+        if(count*2 > slots.size())
+            grow();
+    }
+    
+    // runs the hand until the glyphs fit the budget, or until everything left is pinned (or is the one just added)
+    void evict(uint64_t keep = ~0ull)
+    {
+        size_t mask = slots.size() - 1;
+        // two sweeps of the hand: one to clear every referenced flag, and one to find what that freed
+        size_t steps = 0;
+        while(bytes > budget and count > 0 and steps < slots.size()*2)
+        {
+            auto & entry = slots[hand];
+            if(!entry.value or entry.key == keep or pinned(entry))
+            {
+                hand = (hand + 1) & mask;
+                steps++;
+            }
+            else if(entry.referenced)
+            {
+                entry.referenced = false;
+                hand = (hand + 1) & mask;
+                steps++;
+            }
+            else
+            {
+                // erasing shifts a later glyph back into this slot, so the hand stays to look at it
+                erase(hand);
+                evictions++;
+            }
+        }
+    }
+    
+    // empties slot i, moving later glyphs of the same probe run back so that find still reaches them
+    void erase(size_t i)
+    {
+        bytes -= glyph_bytes(slots[i].value);
+        count--;
+        delete slots[i].value;
+        size_t mask = slots.size() - 1;
+        for(size_t j = (i + 1) & mask; slots[j].value; j = (j + 1) & mask)
+        {
+            // the glyph at j can fill the hole at i unless its home slot lies cyclically in (i, j]
+            size_t home = hash(slots[j].key) & mask;
+            bool stays = (i <= j) ? (i < home and home <= j) : (i < home or home <= j);
+            if(stays)
+                continue;
+            slots[i] = slots[j];
+            i = j;
+        }
+        slots[i] = {0, nullptr, 0, false};
+    }
+    
+    void grow()
+    {
+        std::vector<slot> old(slots.size()*2, {0, nullptr, 0, false});
+        old.swap(slots);
+        for(const auto & entry : old)
+        {
+            if(entry.value)
+                find(entry.key) = entry;
+        }
+        hand = 0;
+    }
+    
+    void clear()
+    {
+        for(auto & entry : slots)
+        {
+            delete entry.value;
+            entry = {0, nullptr, 0, false};
+        }
+        bytes = 0;
+        count = 0;
+    }
+};
+
+// the face at one pixel size; each size gets its own FT_Size so switching sizes doesn't reset freetype's scaling state
+struct sized_font {
+    int32_t size = 0; // 26.6 pixels
+    float scale = 0; // pixels per font unit
+    FT_Size ftsize = nullptr;
+    hb_font_t * hbfont = nullptr;
+    float pixels() const
+    {
+        return size/64.0;
+    }
+};
+
+// same conventions as glyph: x, y is the top left corner relative to the origin, with y going up
+struct glyph_box {
+    int x, y, w, h;
+};
+
+// turns an upright bitmap's box into the box of the same bitmap rotated clockwise for a rotated run
+void rotate_box(glyph_box & box, const sized_font & sized)
+{
+    rotate(box.x, box.y);
+    swap(box.w, box.h);
+    box.x -= box.w;
+    box.x -= sized.pixels()*BASELINE_HACK; // stupid hack because I don't want to attempt to guess baselines
+}
+
+int32_t size_from_pixels(float pixels)
+{
+    return round(pixels*64.0);
+}
+
+// unscaled metrics of one glyph, as harfbuzz reads them from hmtx/vmtx/VORG and the outlines
+struct glyph_metrics {
+    int16_t h_advance, v_advance;
+    int16_t v_origin_x, v_origin_y;
+    int16_t x_bearing, y_bearing, width, height; // ink extents
+};
+
+// Reads every glyph's outline for its extents, which for a big CFF font is most of a first run's startup (see
+// bench_tables); later runs view the table from the snapshot. It's filled up front rather than glyph by glyph on
+// demand because batch workers read it from several threads with nothing to guard a fill.
+std::vector<glyph_metrics> collect_metrics(hb_font_t * hbfont, uint32_t glyph_count)
+{
+    std::vector<glyph_metrics> metrics(glyph_count);
+    for(hb_codepoint_t glyph = 0; glyph < glyph_count; glyph++)
+    {
+        auto & metric = metrics[glyph];
+        metric.h_advance = hb_font_get_glyph_h_advance(hbfont, glyph);
+        metric.v_advance = hb_font_get_glyph_v_advance(hbfont, glyph);
+        hb_position_t x = 0, y = 0;
+        // relative to the horizontal origin, and falls back to a guess the same way shaping does
+        hb_font_get_glyph_origin_for_direction(hbfont, glyph, HB_DIRECTION_TTB, &x, &y);
+        metric.v_origin_x = x;
+        metric.v_origin_y = y;
+        hb_glyph_extents_t extents = {0, 0, 0, 0};
+        hb_font_get_glyph_extents(hbfont, glyph, &extents);
+        metric.x_bearing = extents.x_bearing;
+        metric.y_bearing = extents.y_bearing;
+        metric.width = extents.width;
+        metric.height = extents.height;
+    }
+    return metrics;
+}
+
+// private table that subset fonts carry in place of GSUB; see subset.cpp
+#define VERT_MAP_TAG HB_TAG('V','J','v','t')
+
+struct vert_pair {
+    uint16_t glyph, vertical;
+};
+
+// one opened face; the blob it reads from can be shared with other faces, but everything else belongs to one thread
+struct render_font {
+    const char * filename = nullptr; // for fallbacks, which are only opened once something needs them
+    bool loaded = false;
+    bool failed = false;
+    hb_blob_t * hbblob = nullptr;
+    FT_Face fontface = nullptr;
+    hb_face_t * hbface = nullptr;
+    hb_font_t * hbfont = nullptr;
+    std::map<int32_t, sized_font *> sizes;
+    sized_font unscaled; // size 0; see get_size
+    hb_shape_plan_t * plans[2] = {nullptr, nullptr}; // horizontal, vertical; see get_plan
+    
+    // derived tables; built by build_tables or viewed from a startup snapshot
+    uint32_t upem = 0;
+    uint32_t glyph_count = 0;
+    table_view<uint64_t> vert_glyphs; // one bit per glyph that GSUB 'vert' substitutes
+    table_view<uint64_t> coverage; // one bit per codepoint the cmap maps
+    table_view<glyph_metrics> metrics; // indexed by glyph id, in font units
+    table_view<uint64_t> rotation; // one bit per codepoint that gets rotated in vertical text with this font
+    hb_blob_t * snapshot = nullptr; // keeps viewed tables alive
+    std::vector<vert_pair> vert_map; // only for subset fonts
+    
+    // where the rendered bitmap of a glyph lands relative to its origin, worked out from the metrics table alone
+    glyph_box box(const sized_font & sized, hb_codepoint_t glyph, int mode) const
+    {
+        glyph_box box = {0, 0, 0, 0};
+        if(glyph >= metrics.size)
+            return box;
+        const auto & metric = metrics[glyph];
+        // freetype grid-fits the outline's bounding box outwards
+        int left   = floor( metric.x_bearing                 * sized.scale);
+        int right  =  ceil((metric.x_bearing + metric.width) * sized.scale);
+        int top    =  ceil( metric.y_bearing                 * sized.scale);
+        int bottom = floor((metric.y_bearing + metric.height)* sized.scale);
+        box = {left, top, right - left, top - bottom};
+        if(mode == 2)
+            rotate_box(box, sized);
+        return box;
+    }
+    
+    // the shape plan for one of the context's two segment setups, made on first use; plans belong to the face, so every
+    // size shares them
+    hb_shape_plan_t * get_plan(const hb_segment_properties_t & props)
+    {
+        auto & plan = plans[HB_DIRECTION_IS_VERTICAL(props.direction)];
+        if(!plan)
+            plan = hb_shape_plan_create_cached(hbface, &props, nullptr, 0, nullptr);
+        return plan;
+    }
+    
+    void load_vert_map()
+    {
+        auto table = hb_face_reference_table(hbface, VERT_MAP_TAG);
+        unsigned int size = 0;
+        auto data = (const uint8_t *)hb_blob_get_data(table, &size);
+        if(size >= 4 and ((data[0]<<8) | data[1]) == 1)
+        {
+            unsigned int count = (data[2]<<8) | data[3];
+            for(unsigned int i = 0; i < count and 4 + i*4 + 4 <= size; i++)
+            {
+                auto pair = data + 4 + i*4;
+                vert_map.push_back({uint16_t((pair[0]<<8) | pair[1]), uint16_t((pair[2]<<8) | pair[3])});
+            }
+        }
+        hb_blob_destroy(table);
+    }
+    // does what 'vert' would have done to a shaped vertical run, moving each substituted glyph to its own vertical origin
+    void apply_vert_map(const sized_font & sized, hb_glyph_info_t * glyph_info, hb_glyph_position_t * glyph_pos, unsigned int glyph_count) const
+    {
+        for(unsigned int i = 0; i < glyph_count; i++)
+        {
+            auto glyph = glyph_info[i].codepoint;
+            auto pair = std::lower_bound(vert_map.begin(), vert_map.end(), glyph, [](const vert_pair & a, hb_codepoint_t b)
+            {
+                return a.glyph < b;
+            });
+            if(pair == vert_map.end() or pair->glyph != glyph)
+                continue;
+            glyph_info[i].codepoint = pair->vertical;
+            if(glyph < metrics.size and pair->vertical < metrics.size)
+            {
+                const auto & before = metrics[glyph];
+                const auto & after = metrics[pair->vertical];
+                glyph_pos[i].x_offset += round((before.v_origin_x - after.v_origin_x)*sized.scale*64);
+                glyph_pos[i].y_offset += round((before.v_origin_y - after.v_origin_y)*sized.scale*64);
+            }
+        }
+    }
+    
+    bool covers(uint32_t codepoint) const
+    {
+        if(codepoint >= 0x110000 or !coverage.size)
+            return false;
+        return (coverage[codepoint>>6] >> (codepoint&63)) & 1;
+    }
+    bool rotates(uint32_t codepoint) const
+    {
+        if(codepoint >= 0x110000 or !rotation.size)
+            return true;
+        return (rotation[codepoint>>6] >> (codepoint&63)) & 1;
+    }
+    bool has_vert(hb_codepoint_t glyph) const
+    {
+        if(glyph >= glyph_count)
+            return false;
+        return (vert_glyphs[glyph>>6] >> (glyph&63)) & 1;
+    }
+    // the whole rotate/upright decision, folded down ahead of time so segmentation only has to test a bit
+    void build_rotation(const orientation_data & orientations)
+    {
+        std::vector<uint64_t> rotation_bits(0x110000/64, 0);
+        for(uint32_t codepoint = 0; codepoint < 0x110000; codepoint++)
+        {
+            bool rotate = true;
+            auto orientation = orientations.get(codepoint);
+            if(orientation == -1) rotate = true; // unknown, default to R
+            if(orientation == 0) rotate = false; // U
+            if(orientation == 1) rotate = true; // R
+            if(orientation == 2) rotate = false; // Tu
+            if(orientation == 3) // Tr
+            {
+                hb_codepoint_t glyph = 0;
+                hb_font_get_nominal_glyph(hbfont, codepoint, &glyph);
+                rotate = !has_vert(glyph);
+            }
+            if(rotate)
+                rotation_bits[codepoint>>6] |= uint64_t(1) << (codepoint&63);
+        }
+        rotation.own(std::move(rotation_bits));
+    }
+    void build_tables(const orientation_data & orientations)
+    {
+        std::vector<uint64_t> vert_bits((glyph_count+63)/64, 0);
+        auto vert_set = collect_vert_glyphs(hbface);
+        hb_codepoint_t glyph = HB_SET_VALUE_INVALID;
+        while(hb_set_next(vert_set, &glyph))
+        {
+            if(glyph < glyph_count)
+                vert_bits[glyph>>6] |= uint64_t(1) << (glyph&63);
+        }
+        hb_set_destroy(vert_set);
+        for(const auto & pair : vert_map)
+        {
+            if(pair.glyph < glyph_count)
+                vert_bits[pair.glyph>>6] |= uint64_t(1) << (pair.glyph&63);
+        }
+        vert_glyphs.own(std::move(vert_bits));
+        
+        std::vector<uint64_t> coverage_bits(0x110000/64, 0);
+        auto unicodes = hb_set_create();
+        hb_face_collect_unicodes(hbface, unicodes);
+        hb_codepoint_t codepoint = HB_SET_VALUE_INVALID;
+        while(hb_set_next(unicodes, &codepoint))
+        {
+            if(codepoint < 0x110000)
+                coverage_bits[codepoint>>6] |= uint64_t(1) << (codepoint&63);
+        }
+        hb_set_destroy(unicodes);
+        coverage.own(std::move(coverage_bits));
+        
+        metrics.own(collect_metrics(hbfont, glyph_count));
+        build_rotation(orientations);
+    }
+    
+    // size is in 26.6 pixels; returns nullptr if freetype can't scale the face to it
+    // Size 0 is the face in font units: shaping with it gives positions in font units (not 64ths of them), to be
+    // scaled afterwards. It has no FT_Size, so nothing can be rasterized at it.
+    sized_font * get_size(int32_t size)
+    {
+        if(size == 0)
+            return loaded ? &unscaled : nullptr;
+        // sizes that failed stay in as nullptr, so that once a size is made this never writes to the map again
+        auto found = sizes.find(size);
+        if(found != sizes.end())
+            return found->second;
+        auto & sized = sizes[size];
+        
+        FT_Size ftsize;
+        auto error = FT_New_Size(fontface, &ftsize);
+        if(error)
+        {
+            fprintf(stderr, "Something happened creating a font size\n");
+            return nullptr;
+        }
+        FT_Activate_Size(ftsize);
+        error = FT_Set_Char_Size(fontface, 0, size, 72, 72); // at 72 dpi, points are pixels
+        if(error)
+        {
+            fprintf(stderr, "Something happened setting the font size\n");
+            FT_Done_Size(ftsize);
+            return nullptr;
+        }
+        
+        sized = new sized_font;
+        sized->size = size;
+        sized->scale = size/64.0/upem;
+        sized->ftsize = ftsize;
+        // sub-fonts share the parent's font funcs and face, and only differ in scale
+        sized->hbfont = hb_font_create_sub_font(hbfont);
+        hb_font_set_scale(sized->hbfont, size, size);
+        return sized;
+    }
+    
+    bool load(FT_Library freetype, hb_blob_t * blob)
+    {
+        unsigned int fontsize = 0;
+        auto fontdata = hb_blob_get_data(blob, &fontsize);
+        if(!fontdata)
+        {
+            fprintf(stderr, "font blob is empty\n");
+            return false;
+        }
+        hbblob = hb_blob_reference(blob);
+        
+        // freetype and harfbuzz both read from the same mapping
+        auto error = FT_New_Memory_Face(freetype, (const FT_Byte *)fontdata, fontsize, 0, &fontface);
+        if(error)
+        {
+            fprintf(stderr, "Something happened initializing the font\n");
+            return false;
+        }
+        
+        error = FT_Select_Charmap(fontface, FT_ENCODING_UNICODE);
+        if(error)
+        {
+            fprintf(stderr, "Something happened setting the font character map (font probably doesn't have a unicode mapping)\n");
+            return false;
+        }
+        
+        // we have to do this ourselves instead of using hb-ft because of https://github.com/harfbuzz/harfbuzz/issues/1595
+        
+        hbface = hb_face_create(hbblob, 0);
+        hbfont = hb_font_create(hbface);
+        
+        // left at the default scale (units per em); actual sizes are sub-fonts of this one
+        hb_ot_font_set_funcs(hbfont);
+        
+        upem = hb_face_get_upem(hbface);
+        glyph_count = hb_face_get_glyph_count(hbface);
+        unscaled.hbfont = hbfont;
+        unscaled.scale = 1/64.0; // so that apply_vert_map adds whole units
+
+        load_vert_map();
+        
+        loaded = true;
+        return true;
+    }
+    void unload()
+    {
+        for(auto & entry : sizes)
+        {
+            if(!entry.second)
+                continue;
+            hb_font_destroy(entry.second->hbfont);
+            delete entry.second;
+        }
+        sizes.clear();
+        for(auto & plan : plans)
+        {
+            hb_shape_plan_destroy(plan);
+            plan = nullptr;
+        }
+        // the blob owns the mapping, so freetype has to let go of it first
+        if(fontface)
+            FT_Done_Face(fontface);
+        fontface = nullptr;
+        hb_font_destroy(hbfont);
+        hb_face_destroy(hbface);
+        hb_blob_destroy(hbblob);
+        hbfont = nullptr;
+        hbface = nullptr;
+        hbblob = nullptr;
+        vert_glyphs.clear();
+        coverage.clear();
+        metrics.clear();
+        rotation.clear();
+        hb_blob_destroy(snapshot);
+        snapshot = nullptr;
+        glyph_count = 0;
+        vert_map.clear();
+        loaded = false;
+    }
+};
+
+// a run of codepoints that gets shaped together: same font and, in vertical text, same orientation
+struct run_span {
+    uint32_t offset;
+    uint32_t length;
+    bool rotated;
+    uint16_t font;
+};
+
+// Everything shaping a line scribbles on, reused from one line to the next so that laying out a cue at steady state
+// doesn't allocate. The context has one; each batch worker (see batch.cpp) has its own, with its own sub-fonts.
+struct shape_state {
+    hb_buffer_t * buffer = nullptr;
+    shape_cache * shapes;
+    bool sub_fonts; // shape with this state's own sub-font of each size instead of the size's font itself
+    std::map<std::pair<uint16_t, int32_t>, hb_font_t *> fonts; // (font, size) -> sub-font
+    std::vector<run_span> runs;
+    shape_key lookup;
+    std::vector<const shaped_run *> shaped;
+    std::vector<shaped_run> fresh_runs;
+    std::vector<size_t> run_group;
+    
+    shape_state(shape_cache * shapes, bool sub_fonts) : shapes(shapes), sub_fonts(sub_fonts)
+    {
+        buffer = hb_buffer_create();
+    }
+    ~shape_state()
+    {
+        for(auto & entry : fonts)
+            hb_font_destroy(entry.second);
+        hb_buffer_destroy(buffer);
+    }
+    shape_state(const shape_state &) = delete;
+    shape_state & operator=(const shape_state &) = delete;
+    
+    hb_font_t * font_for(uint16_t which, const sized_font & sized)
+    {
+        if(!sub_fonts)
+            return sized.hbfont;
+        auto & font = fonts[{which, sized.size}];
+        if(!font)
+            font = hb_font_create_sub_font(sized.hbfont);
+        return font;
+    }
+};
+
+// stretch of codepoints that the primary font maps and that all get the same orientation; see segment.cpp
+struct fast_range {
+    uint32_t first, final;
+    bool rotated;
+};
+
+bool load_snapshot(render_font & font, orientation_data * orientations, uint64_t data_hash);
+void save_snapshot(const render_font & font, const orientation_data * orientations, uint64_t data_hash);
+
+// Controls, line and paragraph separators and default ignorables (joiners, bidi marks, variation selectors...): nothing
+// is drawn for them, so they never need a fallback font, however few fonts map them.
+bool never_falls_back(uint32_t codepoint)
+{
+    if(codepoint < 0x20 or (codepoint >= 0x7F and codepoint <= 0x9F))
+        return true;
+    if(codepoint < 0xAD)
+        return false;
+    return codepoint == 0xAD or codepoint == 0x34F or codepoint == 0x61C or (codepoint >= 0x115F and codepoint <= 0x1160)
+        or (codepoint >= 0x17B4 and codepoint <= 0x17B5) or (codepoint >= 0x180B and codepoint <= 0x180F)
+        or (codepoint >= 0x200B and codepoint <= 0x200F) or (codepoint >= 0x2028 and codepoint <= 0x202E)
+        or (codepoint >= 0x2060 and codepoint <= 0x206F) or codepoint == 0x3164 or (codepoint >= 0xFE00 and codepoint <= 0xFE0F)
+        or codepoint == 0xFEFF or codepoint == 0xFFA0 or (codepoint >= 0xFFF0 and codepoint <= 0xFFF8)
+        or (codepoint >= 0x1BCA0 and codepoint <= 0x1BCA3) or (codepoint >= 0x1D173 and codepoint <= 0x1D17A)
+        or (codepoint >= 0xE0000 and codepoint <= 0xE0FFF);
+}
+
+// everything needed to lay out and draw text; contexts don't share mutable state, so one can be used per thread
+struct render_context {
+    bool initialized = false;
+    FT_Library freetype = nullptr;
+    std::vector<render_font *> fonts; // the primary face, then fallbacks in the order they should be tried
+    orientation_data orientations;
+    uint64_t data_hash = 0; // of the orientation data; part of every snapshot's key
+    std::vector<fast_range> fast_ranges;
+    glyph_table cache;
+    shape_cache shapes;
+    
+    shape_state scratch {&shapes, false};
+    hb_segment_properties_t japanese[2]; // horizontal, vertical
+    bool single_pass = true; // shape runs with the same font and direction together; see shaping.cpp
+    
+    render_context(hb_blob_t * fontblob, const std::vector<const char *> & fallbacknames = {})
+    {
+        if(!fontblob)
+            return;
+        
+        auto error = FT_Init_FreeType(&freetype);
+        if(error)
+        {
+            fprintf(stderr, "failed to initialize freetype\n");
+            return;
+        }
+        
+        for(int vertical = 0; vertical < 2; vertical++)
+        {
+            japanese[vertical] = HB_SEGMENT_PROPERTIES_DEFAULT;
+            japanese[vertical].direction = vertical ? HB_DIRECTION_TTB : HB_DIRECTION_LTR;
+            japanese[vertical].script = hb_script_from_string("Jpan", -1);
+            japanese[vertical].language = hb_language_from_string("ja", -1);
+        }
+        
+        fonts.push_back(new render_font);
+        for(auto name : fallbacknames)
+        {
+            fonts.push_back(new render_font);
+            fonts.back()->filename = name;
+        }
+        
+        // with compiled-in orientation data, the data file isn't needed at all
+        bool builtin = orientations.load_builtin();
+        data_hash = builtin ? orientations.hash : hash_file(ORIENTATION_FILE);
+        if(!data_hash)
+        {
+            fprintf(stderr, "failed to open orientation data\n");
+            return;
+        }
+        
+        auto primary = fonts[0];
+        if(!primary->load(freetype, fontblob))
+            return;
+        
+        // a snapshot from an earlier run replaces parsing the orientation data and walking the font's tables
+        auto parsed = builtin ? nullptr : &orientations;
+        if(!load_snapshot(*primary, parsed, data_hash))
+        {
+            if(parsed and !orientations.load(ORIENTATION_FILE))
+            {
+                fprintf(stderr, "failed to open orientation data\n");
+                return;
+            }
+            primary->build_tables(orientations);
+            save_snapshot(*primary, parsed, data_hash);
+        }
+        orientations.hash = data_hash;
+        build_fast_ranges();
+        
+        initialized = true;
+    }
+    ~render_context()
+    {
+        for(auto font : fonts)
+        {
+            font->unload();
+            delete font;
+        }
+        if(freetype)
+            FT_Done_FreeType(freetype);
+    }
+    render_context(const render_context &) = delete;
+    render_context & operator=(const render_context &) = delete;
+    
+    // opens fallbacks on first use; returns nullptr if the font can't be loaded
+    render_font * get_font(uint16_t which)
+    {
+        auto font = fonts[which];
+        if(font->loaded)
+            return font;
+        if(font->failed)
+            return nullptr;
+        
+        auto blob = blob_from_file(font->filename);
+        if(!blob or !font->load(freetype, blob))
+        {
+            fprintf(stderr, "failed to load fallback font %s\n", font->filename);
+            font->unload();
+            font->failed = true;
+        }
+        hb_blob_destroy(blob);
+        if(font->loaded and !load_snapshot(*font, nullptr, data_hash))
+        {
+            font->build_tables(orientations);
+            save_snapshot(*font, nullptr, data_hash);
+        }
+        return font->loaded ? font : nullptr;
+    }
+    
+    // Makes the given size and both shape plans of every font marked in used, so that laying out text at that size
+    // with only those fonts reads from them afterwards and can be done from several threads at once. Fallbacks are
+    // opened by font_for, so segmenting the text first on one thread both picks the fonts and opens them.
+    void preload(int32_t size, const std::vector<bool> & used)
+    {
+        for(uint16_t i = 0; i < fonts.size(); i++)
+        {
+            if(!used[i])
+                continue;
+            auto font = get_font(i);
+            if(!font)
+                continue;
+            // sub-fonts get made from it concurrently
+            auto sized = font->get_size(size);
+            if(sized)
+                hb_font_make_immutable(sized->hbfont);
+            for(const auto & props : japanese)
+                font->get_plan(props);
+        }
+    }
+    
+    // the longest uniform stretches inside the blocks most text is made of (ascii, kana, cjk ideographs, fullwidth forms)
+    void build_fast_ranges()
+    {
+        const uint32_t blocks[][2] = {
+            {0x0020, 0x007E},
+            {0x3041, 0x30FF},
+            {0x4E00, 0x9FFF},
+            {0xFF01, 0xFF9F},
+        };
+        auto primary = fonts[0];
+        std::vector<fast_range> found;
+        for(const auto & block : blocks)
+        {
+            uint32_t start = block[0];
+            for(uint32_t codepoint = block[0]; codepoint <= block[1]+1; codepoint++)
+            {
+                bool ends = codepoint > block[1] or !primary->covers(codepoint) or primary->rotates(codepoint) != primary->rotates(start);
+                if(!ends)
+                    continue;
+                if(primary->covers(start) and codepoint - start >= 16)
+                    found.push_back({start, codepoint - 1, primary->rotates(start)});
+                start = codepoint;
+            }
+        }
+        // segment_runs tests at most eight, so keep the longest ones
+        while(found.size() > 8)
+        {
+            size_t shortest = 0;
+            for(size_t i = 1; i < found.size(); i++)
+            {
+                if(found[i].final - found[i].first < found[shortest].final - found[shortest].first)
+                    shortest = i;
+            }
+            found.erase(found.begin() + shortest);
+        }
+        fast_ranges = found;
+    }
+    
+    // the glyph, rasterized the first time anything asks for it; nullptr if the font can't be made that size
+    glyph * get_glyph(uint16_t font, int32_t size, hb_codepoint_t index, int mode)
+    {
+        auto key = glyph_key(font, size, index, mode);
+        auto & cached = cache.find(key);
+        if(cached.value)
+            return cache.use(cached);
+        auto sized = fonts[font]->get_size(size);
+        if(!sized or !sized->ftsize)
+            return nullptr;
+        auto made = new glyph(*fonts[font], *sized, index, mode);
+        cache.fill(cached, key, made);
+        return made;
+    }
+    
+    // first font in the chain that maps the codepoint; codepoints nothing maps, and ones that never fall back (so never
+    // open a fallback just to be looked up), stay in the current run's font
+    uint16_t font_for(uint32_t codepoint, uint16_t current)
+    {
+        if(fonts[0]->covers(codepoint))
+            return 0;
+        if(never_falls_back(codepoint))
+            return current;
+        for(uint16_t i = 1; i < fonts.size(); i++)
+        {
+            auto font = get_font(i);
+            if(font and font->covers(codepoint))
+                return i;
+        }
+        return current;
+    }
+};
+
+glyph::glyph(render_font & font, sized_font & sized, const uint32_t & glyphindex, int mode)
+{
+    w = 0;
+    h = 0;
+    x = 0;
+    y = 0;
+    
+    if(!font.loaded)
+        return;
+    
+    auto fontface = font.fontface;
+    FT_Activate_Size(sized.ftsize);
+    auto error = FT_Load_Glyph(fontface, glyphindex, FT_LOAD_RENDER|((mode == 1) ? FT_LOAD_VERTICAL_LAYOUT : 0));
+    if(error)
+        return;
+    
+    // hb_glyph_info_t.codepoint is actually the glyph index once hb_shape has been run
+    index = glyphindex;
+    
+    const auto & bitmap = fontface->glyph->bitmap;
+    w = bitmap.width;
+    h = bitmap.rows;
+    x = fontface->glyph->bitmap_left;
+    y = fontface->glyph->bitmap_top;
+    
+    if(bitmap.buffer && bitmap.pixel_mode == FT_PIXEL_MODE_GRAY)
+    {
+        if(mode == 2)
+        {
+            image = rotated_sprite_from_mono(bitmap.buffer, w, h);
+            
+            glyph_box box = {x, y, w, h};
+            rotate_box(box, sized);
+            x = box.x;
+            y = box.y;
+            w = box.w;
+            h = box.h;
+        }
+        else
+            image = sprite_from_mono(bitmap.buffer, w, h);
+    }
+}
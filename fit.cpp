@@ -0,0 +1,149 @@
+// Fitting a cue into a box (a safe area): the largest size the cue can be laid out at without going outside it.
+// The cue is shaped once, with the unscaled fonts, and every size tried only scales those positions the way harfbuzz
+// scales them and measures the result from the metrics table, so the search never reshapes or rasterizes. Only the
+// size that wins gets laid out for real, and that layout is checked against the box too.
+
+// a cue shaped in font units
+struct unscaled_layout {
+    std::vector<hb_codepoint_t> glyphs;
+    std::vector<uint16_t> fonts;
+    std::vector<uint8_t> modes;
+    std::vector<hb_glyph_position_t> units;
+    std::vector<uint8_t> breaks;
+    
+    subtitle scaled; // what gets measured at each size tried
+    std::vector<sized_font> sizes; // per font: only what the metrics need, no freetype or harfbuzz objects
+    
+    void layout(render_context & ctx, shape_state & state, std::string_view text, int mode)
+    {
+        auto bytes = (const uint8_t *)text.data();
+        auto & runs = state.runs;
+        segment_runs(ctx, bytes, text.size(), mode, runs);
+        shape_line(ctx, state, bytes, text.size(), mode, 0);
+        for(size_t r = 0; r < runs.size(); r++)
+        {
+            const auto & run = runs[r];
+            if(!ctx.fonts[run.font]->get_size(0))
+                continue;
+            auto realmode = (run.rotated)?(2):(mode);
+            auto shaped = state.shaped[r];
+            for(size_t i = 0; i < shaped->glyphs.size(); i++)
+            {
+                glyphs.push_back(shaped->glyphs[i]);
+                fonts.push_back(run.font);
+                modes.push_back(realmode);
+                units.push_back(shaped->positions[i]);
+                breaks.push_back(glyph_break_class(bytes, text.size(), *shaped, i, run.offset));
+            }
+        }
+        cache_line(ctx, state, bytes, mode, 0);
+        
+        scaled.mode = mode;
+        scaled.glyphs = glyphs;
+        scaled.breaks = breaks;
+        scaled.positions.clear();
+        sizes.assign(ctx.fonts.size(), sized_font());
+    }
+    
+    // font units to 26.6 pixels the way a sized font gets them from its parent: a sub-font scales what the parent
+    // (at upem) gives it by size/upem, truncating towards zero (hb_font_t::parent_scale_x_distance)
+    static hb_position_t scale_units(hb_position_t units, int32_t size, uint32_t upem)
+    {
+        return hb_position_t(int64_t(units)*size/int64_t(upem));
+    }
+    
+    // the bounds at a size (26.6 pixels), broken into lines max_length long if that's more than 0
+    const subtitle & measure(render_context & ctx, int32_t size, float max_length)
+    {
+        for(size_t f = 0; f < sizes.size(); f++)
+        {
+            sizes[f].size = size;
+            sizes[f].scale = ctx.fonts[f]->loaded ? size/64.0/ctx.fonts[f]->upem : 0;
+        }
+        scaled.size = size;
+        scaled.positions.clear();
+        for(size_t i = 0; i < glyphs.size(); i++)
+        {
+            auto font = ctx.fonts[fonts[i]];
+            auto upem = font->upem;
+            auto pos = units[i];
+            pos.x_advance = scale_units(pos.x_advance, size, upem);
+            pos.y_advance = scale_units(pos.y_advance, size, upem);
+            pos.x_offset = scale_units(pos.x_offset, size, upem);
+            pos.y_offset = scale_units(pos.y_offset, size, upem);
+            scaled.positions.push_back(posdata(pos, font->box(sizes[fonts[i]], glyphs[i], modes[i]), modes[i], breaks[i]));
+        }
+        scaled.wrap(max_length);
+        return scaled;
+    }
+};
+
+bool fits_box(const subtitle & sub, float width, float height)
+{
+    return sub.maxx - sub.minx <= width and sub.maxy - sub.miny <= height;
+}
+
+// Searches with the unscaled layout, then lays text out for real at the size found into out. Kerning and the vertical
+// alternates' offsets round at the real size where the search only truncates, so that can still come out a pixel too
+// big; it steps down a size at a time until the real layout fits too.
+float fit_layout(render_context & ctx, std::string_view text, float width, float height, int mode, bool wrap, float min_size, float max_size, subtitle & out)
+{
+    float max_length = wrap ? ((mode == 1) ? height : width) : 0;
+    auto lay_out = [&](float size)
+    {
+        out = subtitle(ctx, text, size, mode);
+        if(wrap)
+            out.wrap(max_length);
+    };
+    if(!ctx.initialized)
+    {
+        lay_out(min_size);
+        return min_size;
+    }
+    
+    unscaled_layout unscaled;
+    unscaled.layout(ctx, ctx.scratch, text, mode);
+    auto fits = [&](int pixels)
+    {
+        return fits_box(unscaled.measure(ctx, size_from_pixels(pixels), max_length), width, height);
+    };
+    
+    // bigger text takes up more room (wrapping can make that not quite true by a line, which the search doesn't mind)
+    int low = ceil(min_size);
+    int high = floor(max_size);
+    if(high < low or !fits(low))
+    {
+        lay_out(min_size);
+        return min_size;
+    }
+    while(low < high)
+    {
+        int middle = low + (high - low + 1)/2;
+        if(fits(middle))
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    
+    lay_out(low);
+    while(!fits_box(out, width, height) and low - 1 >= min_size)
+        lay_out(--low);
+    return low;
+}
+
+// The largest size, in whole pixels from min_size to max_size, that text fits a width by height box at; min_size if
+// it doesn't fit at any. With wrap, vertical text is broken into columns as tall as the box (horizontal text, into
+// lines as wide as it) and has to fit across the other way.
+float fit_size(render_context & ctx, std::string_view text, float width, float height, int mode = 0, bool wrap = false, float min_size = 8, float max_size = 256)
+{
+    subtitle sub;
+    return fit_layout(ctx, text, width, height, mode, wrap, min_size, max_size, sub);
+}
+
+// text laid out at the size fit_size picks, wrapped the same way
+subtitle fit_subtitle(render_context & ctx, std::string_view text, float width, float height, int mode = 0, bool wrap = false, float min_size = 8, float max_size = 256)
+{
+    subtitle sub;
+    fit_layout(ctx, text, width, height, mode, wrap, min_size, max_size, sub);
+    return sub;
+}
@@ -0,0 +1,63 @@
+// Generates orientation_table.h, the compiled-in form of the UAX #50 vertical orientation data.
+// Run before building the renderer; without the header, the renderer parses the data file at startup instead.
+//     g++ -std=c++17 gen_orientation.cpp -o gen_orientation && ./gen_orientation [VerticalOrientation-17.txt] [orientation_table.h]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <iso646.h>
+
+#include "orientation_parse.cpp"
+
+int main(int argc, char ** argv)
+{
+    auto inname = (argc > 1) ? argv[1] : ORIENTATION_FILE;
+    auto outname = (argc > 2) ? argv[2] : "orientation_table.h";
+    
+    auto data = fopen(inname, "rb");
+    if(!data)
+    {
+        printf("failed to open %s\n", inname);
+        return 1;
+    }
+    // same FNV-1a as hash_file, so the table is keyed the same way as data parsed at runtime
+    uint64_t hash = 0xCBF29CE484222325;
+    int c;
+    while((c = fgetc(data)) != EOF)
+    {
+        hash ^= c;
+        hash *= 0x100000001B3;
+    }
+    rewind(data);
+    auto lines = read_lines(data);
+    fclose(data);
+    
+    std::vector<rule_range> ranges;
+    std::map<uint32_t, int8_t> singles;
+    parse_lines(lines, ranges, singles);
+    
+    std::vector<uint16_t> blocks;
+    std::vector<int8_t> values;
+    build_orientation_stages(ranges, singles, blocks, values);
+    
+    auto out = fopen(outname, "wb");
+    if(!out)
+    {
+        printf("failed to open %s for writing\n", outname);
+        return 1;
+    }
+    fprintf(out, "// generated by gen_orientation.cpp from %s; do not edit\n\n", inname);
+    fprintf(out, "#define ORIENTATION_TABLE_HASH 0x%016llXull\n\n", (unsigned long long)hash);
+    fprintf(out, "constexpr uint16_t orientation_blocks[%zu] = {", blocks.size());
+    for(size_t i = 0; i < blocks.size(); i++)
+        fprintf(out, "%s%u,", (i % 32) ? "" : "\n    ", blocks[i]);
+    fprintf(out, "\n};\n\n");
+    fprintf(out, "// 0: U, 1: R, 2: Tu, 3: Tr, -1: unknown\n");
+    fprintf(out, "constexpr int8_t orientation_values[%zu] = {", values.size());
+    for(size_t i = 0; i < values.size(); i++)
+        fprintf(out, "%s%d,", (i % 32) ? "" : "\n    ", values[i]);
+    fprintf(out, "\n};\n");
+    fclose(out);
+    
+    printf("wrote %s: %zu distinct blocks\n", outname, values.size()/256);
+    return 0;
+}
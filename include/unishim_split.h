@@ -20,6 +20,8 @@ https://creativecommons.org/publicdomain/zero/1.0/legalcode
 
 // #define UNISHIM_DECLARATION_PREFIX to change the declaration prefix from "static" to anything else
 
+// #define UNISHIM_NO_SIMD to keep utf8_decode_bulk from using SSE2/SSSE3/AVX2 even when the compiler targets them.
+
 #include <stdint.h>
 #ifndef UNISHIM_NO_STDLIB
 #include <stdlib.h>
@@ -36,6 +38,21 @@ https://creativecommons.org/publicdomain/zero/1.0/legalcode
 #define UNISHIM_DECLARATION_PREFIX static
 #endif
 
+#ifndef UNISHIM_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UNISHIM_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__) || defined(__AVX2__)
+#define UNISHIM_SSSE3
+#include <tmmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define UNISHIM_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
 typedef int (*unishim_callback)(uint32_t codepoint, UNISHIM_PUN_TYPE * userdata);
 
 /*
@@ -201,4 +218,693 @@ UNISHIM_DECLARATION_PREFIX int utf8_iterate(uint8_t * utf8, size_t max, unishim_
     return 0;
 }
 
+/*
+Decodes the codepoint starting at utf8 (which is position i of the whole buffer) exactly the way utf8_iterate does,
+and returns the same status code utf8_iterate would.
+On success, stores the codepoint and sets *units to the number of code units it took.
+On error, sets *units to the length of the bad part: 1 for a bad initial code unit, or the initial code unit plus
+the continuation code units before the problem (so that a bad continuation code unit gets looked at again as an
+initial one), or the whole sequence for errors 4, 5 and 6.
+*/
+UNISHIM_DECLARATION_PREFIX int utf8_decode_one(const uint8_t * utf8, size_t i, size_t max, uint32_t * codepoint, size_t * units)
+{
+    const uint8_t * counter = utf8;
+    int length;
+    
+    if(counter[0] < 0x80)
+    {
+        *codepoint = counter[0];
+        *units = 1;
+        return 0;
+    }
+    else if(counter[0] < 0xC0)
+    {
+        *units = 1;
+        return 1;
+    }
+    else if(counter[0] < 0xE0)
+        length = 2;
+    else if(counter[0] < 0xF0)
+        length = 3;
+    else if(counter[0] < 0xF8)
+        length = 4;
+    else
+    {
+        *units = 1;
+        return 1;
+    }
+    
+    for(int index = 1; index < length; index++)
+    {
+        // unexpected termination
+        if((max and index+i >= max) or counter[index] == 0)
+        {
+            *units = index;
+            return 2;
+        }
+        // bad continuation byte
+        else if(counter[index] < 0x80 or counter[index] >= 0xC0)
+        {
+            *units = index;
+            return 3;
+        }
+    }
+    
+    *units = length;
+    uint32_t value;
+    if(length == 2)
+    {
+        value = ((uint32_t)(counter[0]&0x1F)<<6) | (counter[1]&0x3F);
+        if(value < 0x80)
+            return 6;
+    }
+    else if(length == 3)
+    {
+        value = ((uint32_t)(counter[0]&0x0F)<<12) | ((uint32_t)(counter[1]&0x3F)<<6) | (counter[2]&0x3F);
+        if(value < 0x800)
+            return 6;
+        if(value > 0xD800 and value < 0xE000)
+            return 4;
+    }
+    else
+    {
+        value = ((uint32_t)(counter[0]&0x07)<<18) | ((uint32_t)(counter[1]&0x3F)<<12) | ((uint32_t)(counter[2]&0x3F)<<6) | (counter[3]&0x3F);
+        if(value < 0x10000)
+            return 6;
+        if(value >= 0x110000)
+            return 5;
+    }
+    *codepoint = value;
+    return 0;
+}
+
+#if defined(UNISHIM_SSSE3)
+/*
+SIMD validation, after Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte" (the "lookup"
+algorithm). Three 16-entry tables, indexed by the high and low nibble of the previous byte and the high nibble of
+the current one, are ANDed together, giving a nonzero byte wherever a two-byte pattern is illegal. Third and fourth
+bytes are checked separately against the code units two and three back.
+Sequences cut off at the end of a block are not reported; the caller only trusts the complete ones.
+Anything rejected here (including surrogates, which utf8_iterate lets through when they're U+D800) gets decoded by
+the scalar path instead, so status codes always come from utf8_decode_one.
+*/
+#define UNISHIM_TOO_SHORT      (1<<0)
+#define UNISHIM_TOO_LONG       (1<<1)
+#define UNISHIM_OVERLONG_3     (1<<2)
+#define UNISHIM_TOO_LARGE      (1<<3)
+#define UNISHIM_SURROGATE      (1<<4)
+#define UNISHIM_OVERLONG_2     (1<<5)
+#define UNISHIM_TOO_LARGE_1000 (1<<6)
+#define UNISHIM_OVERLONG_4     (1<<6)
+#define UNISHIM_TWO_CONTS      ((char)(1<<7))
+#define UNISHIM_CARRY          (UNISHIM_TOO_SHORT | UNISHIM_TOO_LONG | UNISHIM_TWO_CONTS)
+
+#define UNISHIM_TABLE_BYTE_1_HIGH \
+    UNISHIM_TOO_LONG, UNISHIM_TOO_LONG, UNISHIM_TOO_LONG, UNISHIM_TOO_LONG, \
+    UNISHIM_TOO_LONG, UNISHIM_TOO_LONG, UNISHIM_TOO_LONG, UNISHIM_TOO_LONG, \
+    UNISHIM_TWO_CONTS, UNISHIM_TWO_CONTS, UNISHIM_TWO_CONTS, UNISHIM_TWO_CONTS, \
+    UNISHIM_TOO_SHORT | UNISHIM_OVERLONG_2, \
+    UNISHIM_TOO_SHORT, \
+    UNISHIM_TOO_SHORT | UNISHIM_OVERLONG_3 | UNISHIM_SURROGATE, \
+    UNISHIM_TOO_SHORT | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000 | UNISHIM_OVERLONG_4
+
+#define UNISHIM_TABLE_BYTE_1_LOW \
+    UNISHIM_CARRY | UNISHIM_OVERLONG_3 | UNISHIM_OVERLONG_2 | UNISHIM_OVERLONG_4, \
+    UNISHIM_CARRY | UNISHIM_OVERLONG_2, \
+    UNISHIM_CARRY, \
+    UNISHIM_CARRY, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000 | UNISHIM_SURROGATE, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000, \
+    UNISHIM_CARRY | UNISHIM_TOO_LARGE | UNISHIM_TOO_LARGE_1000
+
+#define UNISHIM_TABLE_BYTE_2_HIGH \
+    UNISHIM_TOO_SHORT, UNISHIM_TOO_SHORT, UNISHIM_TOO_SHORT, UNISHIM_TOO_SHORT, \
+    UNISHIM_TOO_SHORT, UNISHIM_TOO_SHORT, UNISHIM_TOO_SHORT, UNISHIM_TOO_SHORT, \
+    UNISHIM_TOO_LONG | UNISHIM_OVERLONG_2 | UNISHIM_TWO_CONTS | UNISHIM_OVERLONG_3 | UNISHIM_TOO_LARGE_1000 | UNISHIM_OVERLONG_4, \
+    UNISHIM_TOO_LONG | UNISHIM_OVERLONG_2 | UNISHIM_TWO_CONTS | UNISHIM_OVERLONG_3 | UNISHIM_TOO_LARGE, \
+    UNISHIM_TOO_LONG | UNISHIM_OVERLONG_2 | UNISHIM_TWO_CONTS | UNISHIM_SURROGATE | UNISHIM_TOO_LARGE, \
+    UNISHIM_TOO_LONG | UNISHIM_OVERLONG_2 | UNISHIM_TWO_CONTS | UNISHIM_SURROGATE | UNISHIM_TOO_LARGE, \
+    UNISHIM_TOO_SHORT, UNISHIM_TOO_SHORT, UNISHIM_TOO_SHORT, UNISHIM_TOO_SHORT
+
+#if defined(UNISHIM_AVX2)
+#define UNISHIM_PREV256(input, prev, N) _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - (N))
+/* nonzero bytes wherever input (preceded by prev) is invalid */
+UNISHIM_DECLARATION_PREFIX __m256i utf8_simd_errors(__m256i input, __m256i prev)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i byte_1_high_table = _mm256_setr_epi8(UNISHIM_TABLE_BYTE_1_HIGH, UNISHIM_TABLE_BYTE_1_HIGH);
+    const __m256i byte_1_low_table = _mm256_setr_epi8(UNISHIM_TABLE_BYTE_1_LOW, UNISHIM_TABLE_BYTE_1_LOW);
+    const __m256i byte_2_high_table = _mm256_setr_epi8(UNISHIM_TABLE_BYTE_2_HIGH, UNISHIM_TABLE_BYTE_2_HIGH);
+    
+    __m256i prev1 = UNISHIM_PREV256(input, prev, 1);
+    __m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i byte_1_low = _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(prev1, nibble));
+    __m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+    
+    __m256i third = _mm256_subs_epu8(UNISHIM_PREV256(input, prev, 2), _mm256_set1_epi8((char)(0xE0-0x80)));
+    __m256i fourth = _mm256_subs_epu8(UNISHIM_PREV256(input, prev, 3), _mm256_set1_epi8((char)(0xF0-0x80)));
+    __m256i must_be_continuation = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must_be_continuation, special);
+}
+/* whether the 64 code units at utf8 hold nothing but valid (possibly cut off at the end) sequences */
+UNISHIM_DECLARATION_PREFIX int utf8_simd_block_valid(const uint8_t * utf8)
+{
+    __m256i first = _mm256_loadu_si256((const __m256i *)utf8);
+    __m256i second = _mm256_loadu_si256((const __m256i *)(utf8 + 32));
+    __m256i errors = _mm256_or_si256(utf8_simd_errors(first, _mm256_setzero_si256()), utf8_simd_errors(second, first));
+    return _mm256_testz_si256(errors, errors);
+}
+#else
+/* nonzero bytes wherever input (preceded by prev) is invalid */
+UNISHIM_DECLARATION_PREFIX __m128i utf8_simd_errors(__m128i input, __m128i prev)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i byte_1_high_table = _mm_setr_epi8(UNISHIM_TABLE_BYTE_1_HIGH);
+    const __m128i byte_1_low_table = _mm_setr_epi8(UNISHIM_TABLE_BYTE_1_LOW);
+    const __m128i byte_2_high_table = _mm_setr_epi8(UNISHIM_TABLE_BYTE_2_HIGH);
+    
+    __m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+    __m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    __m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, nibble));
+    __m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+    
+    __m128i third = _mm_subs_epu8(_mm_alignr_epi8(input, prev, 14), _mm_set1_epi8((char)(0xE0-0x80)));
+    __m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(input, prev, 13), _mm_set1_epi8((char)(0xF0-0x80)));
+    __m128i must_be_continuation = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+    return _mm_xor_si128(must_be_continuation, special);
+}
+/* whether the 64 code units at utf8 hold nothing but valid (possibly cut off at the end) sequences */
+UNISHIM_DECLARATION_PREFIX int utf8_simd_block_valid(const uint8_t * utf8)
+{
+    __m128i prev = _mm_setzero_si128();
+    __m128i errors = _mm_setzero_si128();
+    for(int i = 0; i < 64; i += 16)
+    {
+        __m128i input = _mm_loadu_si128((const __m128i *)(utf8 + i));
+        errors = _mm_or_si128(errors, utf8_simd_errors(input, prev));
+        prev = input;
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(errors, _mm_setzero_si128())) == 0xFFFF;
+}
+#endif
+#endif
+
+#define UNISHIM_REPLACE_INVALID 1
+
+/*
+utf8: pointer to array of uint8_t values, storing utf-8 code units, encoding utf-8 text
+max: zero if array is terminated by a null code unit, nonzero if array has a particular length
+utf32: output array, with room for at least as many codepoints as there are code units in the input
+count: set to the number of codepoints written to utf32
+flags: 0, or UNISHIM_REPLACE_INVALID
+
+Bulk version of utf8_iterate: decodes the whole buffer into utf32 at once.
+Runs of ascii are widened 16 or 32 code units at a time, and other text is validated 64 code units at a time before
+being decoded without per-code-unit checks, when the compiler targets SSE2 (ascii), SSSE3 or AVX2 (validation).
+
+Returns the same status codes as utf8_iterate, and like utf8_iterate, stops at the first error; utf32 then holds the
+codepoints before it.
+With UNISHIM_REPLACE_INVALID, each bad sequence (see utf8_decode_one) is decoded as U+FFFD instead, and the only
+possible error is -1.
+*/
+UNISHIM_DECLARATION_PREFIX int utf8_decode_bulk(const uint8_t * utf8, size_t max, uint32_t * utf32, size_t * count, int flags)
+{
+    size_t i = 0;
+    size_t n = 0;
+    if(count)
+        *count = 0;
+    if(!utf8 or !utf32)
+        return -1;
+    
+    if(!max)
+        while(utf8[max] != 0)
+            max++;
+    
+    while(i < max)
+    {
+        // only look for runs of ascii when the next codepoint is ascii
+#if defined(UNISHIM_AVX2)
+        if(max - i >= 32 and utf8[i] < 0x80)
+        {
+            __m256i bytes = _mm256_loadu_si256((const __m256i *)(utf8 + i));
+            if(_mm256_movemask_epi8(bytes) == 0)
+            {
+                for(int part = 0; part < 32; part += 8)
+                    _mm256_storeu_si256((__m256i *)(utf32 + n + part), _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(utf8 + i + part))));
+                i += 32;
+                n += 32;
+                continue;
+            }
+        }
+#endif
+#if defined(UNISHIM_SSE2)
+        if(max - i >= 16 and utf8[i] < 0x80)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)(utf8 + i));
+            if(_mm_movemask_epi8(bytes) == 0)
+            {
+                __m128i zero = _mm_setzero_si128();
+                __m128i low = _mm_unpacklo_epi8(bytes, zero);
+                __m128i high = _mm_unpackhi_epi8(bytes, zero);
+                _mm_storeu_si128((__m128i *)(utf32 + n     ), _mm_unpacklo_epi16(low, zero));
+                _mm_storeu_si128((__m128i *)(utf32 + n +  4), _mm_unpackhi_epi16(low, zero));
+                _mm_storeu_si128((__m128i *)(utf32 + n +  8), _mm_unpacklo_epi16(high, zero));
+                _mm_storeu_si128((__m128i *)(utf32 + n + 12), _mm_unpackhi_epi16(high, zero));
+                i += 16;
+                n += 16;
+                continue;
+            }
+        }
+#endif
+#if defined(UNISHIM_SSSE3)
+        if(max - i >= 64 and utf8_simd_block_valid(utf8 + i))
+        {
+            // everything that fits entirely inside the block is known to be valid
+            size_t end = i + 64;
+            while(i < end)
+            {
+                const uint8_t * counter = utf8 + i;
+                if(counter[0] < 0x80)
+                {
+                    utf32[n++] = counter[0];
+                    i += 1;
+                }
+                else if(counter[0] < 0xE0)
+                {
+                    if(i + 2 > end)
+                        break;
+                    utf32[n++] = ((uint32_t)(counter[0]&0x1F)<<6) | (counter[1]&0x3F);
+                    i += 2;
+                }
+                else if(counter[0] < 0xF0)
+                {
+                    if(i + 3 > end)
+                        break;
+                    utf32[n++] = ((uint32_t)(counter[0]&0x0F)<<12) | ((uint32_t)(counter[1]&0x3F)<<6) | (counter[2]&0x3F);
+                    i += 3;
+                }
+                else
+                {
+                    if(i + 4 > end)
+                        break;
+                    utf32[n++] = ((uint32_t)(counter[0]&0x07)<<18) | ((uint32_t)(counter[1]&0x3F)<<12) | ((uint32_t)(counter[2]&0x3F)<<6) | (counter[3]&0x3F);
+                    i += 4;
+                }
+            }
+            continue;
+        }
+#endif
+        // checked decoding; goes at least 16 code units before trying the fast paths again
+        size_t end = i + 16;
+        while(i < max and i < end)
+        {
+            const uint8_t * counter = utf8 + i;
+            // well-formed three code unit sequences (most of cjk) skip the general path
+            if((counter[0] & 0xF0) == 0xE0 and max - i >= 3 and (counter[1] & 0xC0) == 0x80 and (counter[2] & 0xC0) == 0x80)
+            {
+                uint32_t codepoint = ((uint32_t)(counter[0]&0x0F)<<12) | ((uint32_t)(counter[1]&0x3F)<<6) | (counter[2]&0x3F);
+                if(codepoint >= 0x800 and (codepoint <= 0xD800 or codepoint >= 0xE000))
+                {
+                    utf32[n++] = codepoint;
+                    i += 3;
+                    continue;
+                }
+            }
+            uint32_t codepoint = 0;
+            size_t units = 1;
+            int status = utf8_decode_one(counter, i, max, &codepoint, &units);
+            if(status)
+            {
+                if(!(flags & UNISHIM_REPLACE_INVALID))
+                {
+                    if(count)
+                        *count = n;
+                    return status;
+                }
+                codepoint = 0xFFFD;
+            }
+            utf32[n++] = codepoint;
+            i += units;
+        }
+    }
+    
+    if(count)
+        *count = n;
+    return 0;
+}
+
+/*
+Decodes the codepoint starting at utf16 (which is position i of the whole buffer) and returns a status code as in
+utf16_iterate. On success, stores the codepoint and sets *units to the number of code units it took (1 or 2).
+*/
+UNISHIM_DECLARATION_PREFIX int utf16_decode_one(const uint16_t * utf16, size_t i, size_t max, uint32_t * codepoint, size_t * units)
+{
+    const uint16_t * counter = utf16;
+    *units = 1;
+    
+    // trivial code unit
+    if(counter[0] < 0xD800 or counter[0] >= 0xE000)
+    {
+        *codepoint = counter[0];
+        return 0;
+    }
+    // low surrogate where high surrogate or trivial code unit expected
+    else if(counter[0] >= 0xDC00)
+        return 1;
+    
+    // unexpected termination
+    if((max and i+1 >= max) or counter[1] == 0)
+        return 2;
+    // high surrogate or trivial code unit where low surrogate expected
+    else if(counter[1] < 0xDC00 or counter[1] >= 0xE000)
+        return 3;
+    
+    *codepoint = 0x10000 + (((uint32_t)(counter[0]&0x3FF)<<10) | (counter[1]&0x3FF));
+    *units = 2;
+    return 0;
+}
+
+/*
+utf16: pointer to array of uint16_t values, storing utf-16 code units, encoding utf-16 text
+max: zero if array is terminated by a null code unit, nonzero if array has a particular length
+callback: int unishim_callback(uint32_t codepoint, void * userdata);
+userdata: user data, given to callback
+
+Same as utf8_iterate, but for utf-16. Status codes:
+-1: argument is invalid (utf16 buffer pointer is null)
+0: no error, covered all codepoints
+1: low surrogate where high surrogate or non-surrogate expected
+2: surrogate pair truncated by null terminator or end of buffer (position >= max)
+3: high surrogate or non-surrogate where low surrogate expected
+*/
+UNISHIM_DECLARATION_PREFIX int utf16_iterate(uint16_t * utf16, size_t max, unishim_callback callback, void * userdata)
+{
+    if(!utf16)
+        return -1;
+    
+    size_t i = 0;
+    while((max) ? (i < max) : (utf16[i] != 0))
+    {
+        uint32_t codepoint = 0;
+        size_t units = 1;
+        int status = utf16_decode_one(utf16 + i, i, max, &codepoint, &units);
+        if(status)
+            return status;
+        
+        if(callback)
+        {
+            int r = callback(codepoint, userdata);
+            if(r) return r;
+        }
+        
+        i += units;
+    }
+    return 0;
+}
+
+/*
+utf32: pointer to array of uint32_t values, storing codepoints
+max: zero if array is terminated by a null code unit, nonzero if array has a particular length
+callback: int unishim_callback(uint32_t codepoint, void * userdata);
+userdata: user data, given to callback
+
+Same as utf8_iterate, but for utf-32. Status codes:
+-1: argument is invalid (utf32 buffer pointer is null)
+0: no error, covered all codepoints
+4: codepoint is a surrogate, which is forbidden
+5: codepoint is too large to encode in utf-16, which is forbidden
+*/
+UNISHIM_DECLARATION_PREFIX int utf32_iterate(uint32_t * utf32, size_t max, unishim_callback callback, void * userdata)
+{
+    if(!utf32)
+        return -1;
+    
+    size_t i = 0;
+    while((max) ? (i < max) : (utf32[i] != 0))
+    {
+        uint32_t codepoint = utf32[i];
+        if(codepoint >= 0xD800 and codepoint < 0xE000)
+            return 4;
+        if(codepoint >= 0x110000)
+            return 5;
+        
+        if(callback)
+        {
+            int r = callback(codepoint, userdata);
+            if(r) return r;
+        }
+        
+        i += 1;
+    }
+    return 0;
+}
+
+/*
+Streaming utf-8 decoder, for text that arrives in pieces (pipes, sockets) where a piece can end partway through a
+multibyte sequence. The stream holds on to at most the three code units of an unfinished sequence between calls;
+everything else is decoded straight out of the caller's buffer.
+
+    unishim_utf8_stream stream;
+    utf8_stream_init(&stream);
+    while(more input)
+        utf8_stream_decode(&stream, bytes, size, utf32, &count, flags);
+    utf8_stream_finish(&stream, utf32, &count, flags);
+*/
+typedef struct {
+    uint8_t pending[4];
+    uint8_t have; // code units in pending
+    uint8_t need; // length of the sequence pending starts
+} unishim_utf8_stream;
+
+UNISHIM_DECLARATION_PREFIX void utf8_stream_init(unishim_utf8_stream * stream)
+{
+    stream->have = 0;
+    stream->need = 0;
+}
+
+/*
+stream: decoder state, from utf8_stream_init
+utf8: the next size code units of the text; null code units are decoded as U+0000, not treated as a terminator
+utf32: output array, with room for at least size+1 codepoints
+count: set to the number of codepoints written to utf32
+flags: 0, or UNISHIM_REPLACE_INVALID
+
+Decodes as much as possible. A sequence cut off by the end of the input is kept in the stream and finished by the
+next call instead of reporting error 2.
+Returns the same status codes as utf8_iterate, and stops at the first error (utf32 then holds the codepoints before
+it, and the stream is reset, dropping the rest of this input). With UNISHIM_REPLACE_INVALID, bad sequences become
+U+FFFD and decoding carries on.
+*/
+UNISHIM_DECLARATION_PREFIX int utf8_stream_decode(unishim_utf8_stream * stream, const uint8_t * utf8, size_t size, uint32_t * utf32, size_t * count, int flags)
+{
+    size_t i = 0;
+    size_t n = 0;
+    if(count)
+        *count = 0;
+    if(!stream or (!utf8 and size) or !utf32)
+        return -1;
+    
+    // finish the sequence left over from last time
+    if(stream->have)
+    {
+        while(stream->have < stream->need and i < size and utf8[i] >= 0x80 and utf8[i] < 0xC0)
+            stream->pending[stream->have++] = utf8[i++];
+        if(stream->have < stream->need and i == size)
+            return 0;
+        
+        uint32_t codepoint = 0;
+        size_t units = 1;
+        // a code unit that can't continue the sequence stops it early, and then gets decoded on its own below
+        int status = (stream->have < stream->need) ? ((utf8[i] == 0) ? 2 : 3) : utf8_decode_one(stream->pending, 0, stream->have, &codepoint, &units);
+        stream->have = 0;
+        if(status)
+        {
+            if(!(flags & UNISHIM_REPLACE_INVALID))
+                return status;
+            codepoint = 0xFFFD;
+        }
+        utf32[n++] = codepoint;
+    }
+    
+    // hold back a sequence that runs past the end of the input; anything else at the end is left for the decoder
+    size_t end = size;
+    for(size_t back = 1; back <= 3 and back <= size - i; back++)
+    {
+        uint8_t unit = utf8[size - back];
+        if(unit >= 0x80 and unit < 0xC0)
+            continue;
+        uint8_t length = (unit >= 0xC0 and unit < 0xE0) ? 2 : (unit >= 0xE0 and unit < 0xF0) ? 3 : (unit >= 0xF0 and unit < 0xF8) ? 4 : 0;
+        if(length > back)
+        {
+            end = size - back;
+            stream->need = length;
+        }
+        break;
+    }
+    
+    // a sequence cut short by the held back one is a bad continuation, not a truncation, and so can be the one before
+    // that; the earliest of them is where decoding stops
+    if(end < size and !(flags & UNISHIM_REPLACE_INVALID))
+    {
+        size_t stop = end;
+        for(size_t back = 1; back <= 3 and back <= stop - i; back++)
+        {
+            uint8_t unit = utf8[stop - back];
+            if(unit >= 0x80 and unit < 0xC0)
+                continue;
+            uint8_t length = (unit >= 0xC0 and unit < 0xE0) ? 2 : (unit >= 0xE0 and unit < 0xF0) ? 3 : (unit >= 0xF0 and unit < 0xF8) ? 4 : 0;
+            if(length <= back)
+                break;
+            stop -= back;
+            back = 0;
+        }
+        if(stop < end)
+        {
+            size_t decoded = 0;
+            int status = 0;
+            if(stop > i)
+                status = utf8_decode_bulk(utf8 + i, stop - i, utf32 + n, &decoded, flags);
+            if(count)
+                *count = n + decoded;
+            return status ? status : 3;
+        }
+    }
+    
+    size_t decoded = 0;
+    int status = 0;
+    if(end > i)
+        status = utf8_decode_bulk(utf8 + i, end - i, utf32 + n, &decoded, flags);
+    n += decoded;
+    if(count)
+        *count = n;
+    if(status)
+        return status;
+    
+    while(end < size)
+        stream->pending[stream->have++] = utf8[end++];
+    return 0;
+}
+
+/*
+Ends the stream. A sequence still left unfinished is error 2, or one U+FFFD with UNISHIM_REPLACE_INVALID.
+utf32 needs room for one codepoint. The stream can be reused afterwards.
+*/
+UNISHIM_DECLARATION_PREFIX int utf8_stream_finish(unishim_utf8_stream * stream, uint32_t * utf32, size_t * count, int flags)
+{
+    if(count)
+        *count = 0;
+    if(!stream or !utf32)
+        return -1;
+    if(!stream->have)
+        return 0;
+    stream->have = 0;
+    if(!(flags & UNISHIM_REPLACE_INVALID))
+        return 2;
+    utf32[0] = 0xFFFD;
+    if(count)
+        *count = 1;
+    return 0;
+}
+
+#ifdef __cplusplus
+/*
+C++ only: utf8_iterate, utf16_iterate and utf32_iterate, taking any callable instead of a function pointer and userdata.
+
+    int status = utf8_iterate(text, 0, [&](uint32_t codepoint) -> int { ...; return 0; });
+
+The callable is called as callback(codepoint) and has to return int, with the same meaning as the C version's return
+value. Status codes and stopping behavior are the same as the C versions, but the calls can be inlined.
+*/
+template<typename F>
+int utf8_iterate(const uint8_t * utf8, size_t max, F && callback)
+{
+    if(!utf8)
+        return -1;
+    
+    size_t i = 0;
+    while((max) ? (i < max) : (utf8[i] != 0))
+    {
+        const uint8_t * counter = utf8 + i;
+        uint32_t codepoint = 0;
+        size_t units = 1;
+        if(counter[0] < 0x80)
+            codepoint = counter[0];
+        // well-formed three code unit sequences skip the general path, as in utf8_decode_bulk
+        else if((counter[0] & 0xF0) == 0xE0 and (!max or max - i >= 3) and (counter[1] & 0xC0) == 0x80 and (counter[2] & 0xC0) == 0x80
+                and (codepoint = ((uint32_t)(counter[0]&0x0F)<<12) | ((uint32_t)(counter[1]&0x3F)<<6) | (counter[2]&0x3F)) >= 0x800
+                and (codepoint <= 0xD800 or codepoint >= 0xE000))
+            units = 3;
+        else
+        {
+            int status = utf8_decode_one(counter, i, max, &codepoint, &units);
+            if(status)
+                return status;
+        }
+        
+        int r = callback(codepoint);
+        if(r) return r;
+        
+        i += units;
+    }
+    return 0;
+}
+
+template<typename F>
+int utf16_iterate(const uint16_t * utf16, size_t max, F && callback)
+{
+    if(!utf16)
+        return -1;
+    
+    size_t i = 0;
+    while((max) ? (i < max) : (utf16[i] != 0))
+    {
+        uint32_t codepoint = 0;
+        size_t units = 1;
+        int status = utf16_decode_one(utf16 + i, i, max, &codepoint, &units);
+        if(status)
+            return status;
+        
+        int r = callback(codepoint);
+        if(r) return r;
+        
+        i += units;
+    }
+    return 0;
+}
+
+template<typename F>
+int utf32_iterate(const uint32_t * utf32, size_t max, F && callback)
+{
+    if(!utf32)
+        return -1;
+    
+    size_t i = 0;
+    while((max) ? (i < max) : (utf32[i] != 0))
+    {
+        uint32_t codepoint = utf32[i];
+        if(codepoint >= 0xD800 and codepoint < 0xE000)
+            return 4;
+        if(codepoint >= 0x110000)
+            return 5;
+        
+        int r = callback(codepoint);
+        if(r) return r;
+        
+        i += 1;
+    }
+    return 0;
+}
+#endif
+
 #endif
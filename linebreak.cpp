@@ -0,0 +1,80 @@
+// Line breaking rules (kinsoku shori). Each glyph gets the break class of the codepoint its cluster starts with when
+// it's laid out, so wrapping afterwards only has to look at classes and advances; see subtitle::wrap.
+
+#define BREAK_INSIDE      1 // not the first glyph of its cluster, so never a place to break
+#define BREAK_NO_START    2 // closing brackets, small kana, the long vowel mark, punctuation: can't start a line
+#define BREAK_NO_END      4 // opening brackets: can't end a line
+#define BREAK_INSEPARABLE 8 // ellipses and dashes: no break between two of them
+#define BREAK_HARD       16 // newlines: always break after, and take up no room (no advance, not measured or drawn)
+#define BREAK_WORD       32 // latin letters and digits: no break inside a word
+#define BREAK_HANG       64 // spaces, commas and full stops: can hang past the end of a line instead of being pushed on
+#define BREAK_INFIX     128 // full stops and commas that hold a word together when there's one on each side: 3.14, example.com
+
+uint8_t break_class(uint32_t codepoint)
+{
+    // ideographs break anywhere, and they're a good share of any cue
+    if(codepoint >= 0x4E00 and codepoint <= 0x9FFF)
+        return 0;
+    if((codepoint >= '0' and codepoint <= '9') or (codepoint >= 'A' and codepoint <= 'Z') or (codepoint >= 'a' and codepoint <= 'z')
+       or (codepoint >= 0xC0 and codepoint <= 0x24F and codepoint != 0xD7 and codepoint != 0xF7)
+       // fullwidth digits and letters
+       or (codepoint >= 0xFF10 and codepoint <= 0xFF19) or (codepoint >= 0xFF21 and codepoint <= 0xFF3A) or (codepoint >= 0xFF41 and codepoint <= 0xFF5A))
+        return BREAK_WORD;
+    switch(codepoint)
+    {
+    case '\n': case 0x2028: case 0x2029:
+        return BREAK_HARD;
+    case ' ': case '\t': case 0x3001: case 0x3002:
+        return BREAK_NO_START | BREAK_HANG;
+    case ',': case '.': case 0xFF0C: case 0xFF0E:
+        return BREAK_NO_START | BREAK_HANG | BREAK_INFIX;
+    // small kana
+    case 0x3041: case 0x3043: case 0x3045: case 0x3047: case 0x3049: case 0x3063: case 0x3083: case 0x3085:
+    case 0x3087: case 0x308E: case 0x3095: case 0x3096:
+    case 0x30A1: case 0x30A3: case 0x30A5: case 0x30A7: case 0x30A9: case 0x30C3: case 0x30E3: case 0x30E5:
+    case 0x30E7: case 0x30EE: case 0x30F5: case 0x30F6:
+    // long vowel mark, iteration marks, middle dot
+    case 0x30FC: case 0x309D: case 0x309E: case 0x30FD: case 0x30FE: case 0x3005: case 0x303B: case 0x30FB:
+    // closing brackets
+    case 0xFF1A: case 0xFF1B: case 0xFF1F: case 0xFF01:
+    case 0x300D: case 0x300F: case 0xFF09: case 0xFF3D: case 0xFF5D: case 0x3015: case 0x3009: case 0x300B:
+    case 0x3011: case 0x3019: case 0x3017: case 0x301F: case 0x2019: case 0x201D: case 0xFF60: case 0xFF63:
+    case 0x203C: case 0x2047: case 0x2048: case 0x2049: case 0x301C: case 0x30A0:
+    case ')': case ']': case '}': case ':': case ';': case '?': case '!':
+        return BREAK_NO_START;
+    // opening brackets
+    case 0x300C: case 0x300E: case 0xFF08: case 0xFF3B: case 0xFF5B: case 0x3014: case 0x3008: case 0x300A:
+    case 0x3010: case 0x3018: case 0x3016: case 0x301D: case 0x2018: case 0x201C: case 0xFF5F: case 0xFF62:
+    case '(': case '[': case '{':
+        return BREAK_NO_END;
+    case 0x2026: case 0x2025: case 0x2014: case 0x2015:
+        return BREAK_INSEPARABLE;
+    }
+    // small katakana for ainu
+    if(codepoint >= 0x31F0 and codepoint <= 0x31FF)
+        return BREAK_NO_START;
+    return 0;
+}
+
+// the codepoint a cluster starts with
+uint32_t codepoint_at(const uint8_t * text, size_t length, uint32_t offset)
+{
+    uint32_t codepoint = text[offset];
+    size_t units = 1;
+    if(codepoint >= 0x80 and utf8_decode_one(text + offset, offset, length, &codepoint, &units) != 0)
+        codepoint = 0xFFFD;
+    return codepoint;
+}
+uint32_t codepoint_at(const uint32_t * text, size_t, uint32_t offset)
+{
+    return text[offset];
+}
+
+// the break class of glyph i of a shaped run
+template<typename T>
+uint8_t glyph_break_class(const T * text, size_t length, const shaped_run & shaped, size_t i, uint32_t run_offset)
+{
+    if(i > 0 and shaped.clusters[i] == shaped.clusters[i - 1])
+        return BREAK_INSIDE;
+    return break_class(codepoint_at(text, length, shaped.clusters[i] + run_offset));
+}
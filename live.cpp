@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+// Live captions: vertjp --live. Lines of utf-8 come in on stdin, from a pipe or a terminal, and each one is rendered
+// to caption-NNNNNN.png as soon as its newline arrives; the file name is printed once it's written, and stdout carries
+// nothing else (diagnostics go to stderr). Reads return whatever is available, so a read can end partway through a
+// character; the stream decoder carries it over.
+
+// reads whatever stdin has, up to size bytes; 0 at the end of input, -1 on error (reads cut short by a signal are retried)
+long read_stdin(uint8_t * data, size_t size)
+{
+    while(true)
+    {
+#ifdef _WIN32
+        long got = _read(0, data, (unsigned int)size);
+#else
+        long got = read(0, data, size);
+#endif
+        if(got >= 0 or errno != EINTR)
+            return got;
+    }
+}
+
+int run_live(render_context & ctx, int mode)
+{
+    if(!ctx.initialized)
+        return 1;
+    
+    unishim_utf8_stream stream;
+    utf8_stream_init(&stream);
+    
+    std::vector<uint8_t> input(4096);
+    std::vector<uint32_t> decoded(input.size() + 1);
+    std::vector<uint32_t> line;
+    int captions = 0;
+    
+    auto finish_line = [&]
+    {
+        if(line.size() and line.back() == '\r')
+            line.pop_back();
+        if(line.size())
+        {
+            subtitle sub(ctx, line.data(), line.size(), FONTSIZE, mode);
+            char filename[32];
+            snprintf(filename, sizeof(filename), "caption-%06d.png", captions++);
+            if(save_subtitle_png(ctx, sub, filename))
+            {
+                puts(filename);
+                fflush(stdout);
+            }
+            else
+                fprintf(stderr, "failed to write %s\n", filename);
+        }
+        line.clear();
+    };
+    
+    long got;
+    while((got = read_stdin(input.data(), input.size())) > 0)
+    {
+        size_t count = 0;
+        utf8_stream_decode(&stream, input.data(), got, decoded.data(), &count, UNISHIM_REPLACE_INVALID);
+        for(size_t i = 0; i < count; i++)
+        {
+            if(decoded[i] == '\n')
+                finish_line();
+            else
+                line.push_back(decoded[i]);
+        }
+    }
+    if(got < 0)
+    {
+        fprintf(stderr, "failed to read stdin: %s\n", strerror(errno));
+        return 1;
+    }
+    
+    size_t count = 0;
+    utf8_stream_finish(&stream, decoded.data(), &count, UNISHIM_REPLACE_INVALID);
+    line.insert(line.end(), decoded.begin(), decoded.begin() + count);
+    finish_line();
+    
+    return 0;
+}
@@ -0,0 +1,168 @@
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// read-only view of a whole file, shared by every consumer instead of being copied into a heap buffer
+struct mapped_file {
+    uint8_t * data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+void unmap_file(mapped_file & file)
+{
+#ifdef _WIN32
+    if(file.data)
+        UnmapViewOfFile(file.data);
+    if(file.mapping)
+        CloseHandle(file.mapping);
+    if(file.file != INVALID_HANDLE_VALUE)
+        CloseHandle(file.file);
+    file.file = INVALID_HANDLE_VALUE;
+    file.mapping = nullptr;
+#else
+    if(file.data)
+        munmap(file.data, file.size);
+#endif
+    file.data = nullptr;
+    file.size = 0;
+}
+
+bool map_file(const char * filename, mapped_file & out)
+{
+    out = mapped_file();
+#ifdef _WIN32
+    out.file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(out.file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(out.file, &size) or size.QuadPart == 0)
+    {
+        unmap_file(out);
+        return false;
+    }
+    out.size = size.QuadPart;
+    out.mapping = CreateFileMappingA(out.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!out.mapping)
+    {
+        unmap_file(out);
+        return false;
+    }
+    out.data = (uint8_t *)MapViewOfFile(out.mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!out.data)
+    {
+        unmap_file(out);
+        return false;
+    }
+#else
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat info;
+    if(fstat(fd, &info) != 0 or info.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    void * data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+    if(data == MAP_FAILED)
+        return false;
+    // font tables get read sparsely (cmap, a few charstrings, GSUB), so don't let the kernel read ahead the whole file
+    madvise(data, info.st_size, MADV_RANDOM);
+    out.data = (uint8_t *)data;
+    out.size = info.st_size;
+#endif
+    return true;
+}
+
+// wraps a mapped file in a harfbuzz blob; the file gets unmapped when the last reference to the blob is destroyed
+hb_blob_t * blob_from_file(const char * filename)
+{
+    auto file = new mapped_file;
+    if(!map_file(filename, *file))
+    {
+        delete file;
+        return nullptr;
+    }
+    return hb_blob_create((const char *)file->data, file->size, HB_MEMORY_MODE_READONLY, file, [](void * userdata)
+    {
+        auto file = (mapped_file *)userdata;
+        unmap_file(*file);
+        delete file;
+    });
+}
+
+// array that either owns its elements or points into mapped data (e.g. a startup snapshot) that something else keeps alive
+template<typename T>
+struct table_view {
+    const T * data = nullptr;
+    size_t size = 0;
+    std::vector<T> storage;
+    
+    table_view() { }
+    table_view(const table_view &) = delete;
+    table_view & operator=(const table_view &) = delete;
+    
+    void own(std::vector<T> && elements)
+    {
+        storage = std::move(elements);
+        data = storage.data();
+        size = storage.size();
+    }
+    void view(const T * elements, size_t count)
+    {
+        storage.clear();
+        data = elements;
+        size = count;
+    }
+    void clear()
+    {
+        view(nullptr, 0);
+    }
+    const T & operator[](size_t i) const
+    {
+        return data[i];
+    }
+    const T * begin() const
+    {
+        return data;
+    }
+    const T * end() const
+    {
+        return data + size;
+    }
+};
+
+uint64_t hash_bytes(const void * bytes, size_t count, uint64_t hash = 0xCBF29CE484222325) // FNV-1a
+{
+    auto data = (const uint8_t *)bytes;
+    for(size_t i = 0; i < count; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+// zero if the file can't be read
+uint64_t hash_file(const char * filename)
+{
+    mapped_file file;
+    if(!map_file(filename, file))
+        return 0;
+    auto hash = hash_bytes(file.data, file.size);
+    unmap_file(file);
+    return hash;
+}
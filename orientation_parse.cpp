@@ -0,0 +1,107 @@
+#include <vector>
+#include <map>
+#include <string>
+
+// parsing for the UAX #50 data file, shared by the renderer and gen_orientation.cpp
+
+#define ORIENTATION_FILE "VerticalOrientation-17.txt"
+
+struct rule_range {
+    uint32_t first;
+    uint32_t final;
+    int8_t orientation;
+};
+
+std::vector<std::string> read_lines(FILE * f)
+{
+    std::vector<std::string> ret{std::string("")};
+    
+    while(!ferror(f) and !feof(f))
+    {
+        int c = fgetc(f);
+        if(c >= 0 and c < 0x100 and c != '\r' and c != '\n')
+            ret.back() += c;
+        if(c == '\n')
+            ret.push_back(std::string(""));
+        if(c < 0 or c >= 0x100)
+            break;
+    }
+    return ret;
+}
+
+uint32_t from_hex(std::string hexstring)
+{
+    return std::stoul(hexstring.data(), nullptr, 16);
+}
+int8_t parse_mode(std::string text)
+{
+    // the field can be padded and followed by a "# ..." comment
+    auto start = text.find_first_not_of(" \t");
+    if(start == std::string::npos)
+        return -1;
+    text = text.substr(start, text.find_first_of(" \t#", start) - start);
+    if(text == "U") return 0;
+    if(text == "R") return 1;
+    if(text == "Tu") return 2;
+    if(text == "Tr") return 3;
+    return -1;
+}
+
+void parse_lines(std::vector<std::string> & lines, std::vector<rule_range> & ranges, std::map<uint32_t, int8_t> & singles)
+{
+    for(const auto & line : lines)
+    {
+        if(line.size() == 0 or line.data()[0] == '#')
+            continue;
+        auto split_loc = line.find(" ; ");
+        if(split_loc == std::string::npos)
+            continue;
+        auto range_loc = line.find("..");
+        if(range_loc == std::string::npos or range_loc > split_loc)
+        {
+            auto codepoint = line.substr(0, split_loc);
+            auto mode = line.substr(split_loc+3, -1);
+            singles[from_hex(codepoint)] = parse_mode(mode);
+        }
+        else
+        {
+            auto first = line.substr(0, range_loc);
+            auto final = line.substr(range_loc+2, split_loc - (range_loc+2));
+            auto mode = line.substr(split_loc+3, -1);
+            ranges.push_back({from_hex(first), from_hex(final), parse_mode(mode)});
+        }
+    }
+}
+
+// Two-stage lookup table: blocks[codepoint>>8] picks one of the distinct 256-entry blocks in values. Most of the
+// codespace is a handful of repeated blocks (all R, all U), so the whole thing is a few dozen kilobytes.
+void build_orientation_stages(const std::vector<rule_range> & ranges, const std::map<uint32_t, int8_t> & singles, std::vector<uint16_t> & blocks, std::vector<int8_t> & values)
+{
+    std::vector<int8_t> flat(0x110000, 1); // default to R
+    // applied back to front so that the first matching range wins, as in a linear scan
+    for(auto range = ranges.rbegin(); range != ranges.rend(); range++)
+    {
+        for(uint32_t codepoint = range->first; codepoint <= range->final and codepoint < 0x110000; codepoint++)
+            flat[codepoint] = range->orientation;
+    }
+    for(const auto & single : singles)
+    {
+        if(single.first < 0x110000)
+            flat[single.first] = single.second;
+    }
+    
+    std::map<std::vector<int8_t>, uint16_t> seen;
+    blocks.clear();
+    values.clear();
+    for(uint32_t block = 0; block < 0x110000/256; block++)
+    {
+        std::vector<int8_t> contents(flat.begin() + block*256, flat.begin() + block*256 + 256);
+        auto found = seen.find(contents);
+        if(found == seen.end())
+        {
+            found = seen.insert({contents, uint16_t(values.size()/256)}).first;
+            values.insert(values.end(), contents.begin(), contents.end());
+        }
+        blocks.push_back(found->second);
+    }
+}
@@ -0,0 +1,464 @@
+// A subtitle that follows edits to its text, for live captions and typewriter effects. An edit re-segments from where
+// it starts until the runs line up with the old ones again, and only reshapes a window around it: each run the window
+// touches keeps its old glyphs up to the last cluster before the window that harfbuzz says is safe to break at, and
+// from the first safe one after it, the same test shaping.cpp uses to slice runs out of a shared buffer. The window is
+// the edit plus the context harfbuzz looks at on either side, so appending to a long run costs the same as to a short
+// one. Glyph positions are relative to the pen, so nothing else moves; the bounds are refolded from per-run totals,
+// which are kept per glyph so that they're only redone from the first glyph that changed.
+// Edits in the middle still move the glyphs after them along and shift their clusters, but appending only touches the
+// end. Text is codepoints, and clusters are codepoint indexes, as with the subtitle constructor that takes them.
+
+#define RELAYOUT_CONTEXT 5 // codepoints of context harfbuzz reads past either end of what it shapes (CONTEXT_LENGTH)
+
+struct editable_subtitle {
+    // a run's glyphs up to some point, relative to the pen where the run starts
+    struct extent {
+        float x = 0, y = 0; // the pen after them
+        bool measured = false; // has glyphs other than hard breaks, which take up no room
+        float ink_minx, ink_miny, ink_maxx, ink_maxy;
+        float pen_maxx, pen_maxy; // of the pen after each glyph
+        
+        void add(const posdata & pos, uint8_t breaks)
+        {
+            if(breaks & BREAK_HARD)
+                return;
+            if(!measured)
+            {
+                measured = true;
+                ink_minx = x + pos.x;
+                ink_miny = y + pos.y;
+                ink_maxx = x + pos.x2;
+                ink_maxy = y + pos.y2;
+                pen_maxx = x + pos.x_advance;
+                pen_maxy = y + pos.y_advance;
+            }
+            ink_minx = macro_min(ink_minx, x + pos.x);
+            ink_miny = macro_min(ink_miny, y + pos.y);
+            ink_maxx = macro_max(ink_maxx, x + pos.x2);
+            ink_maxy = macro_max(ink_maxy, y + pos.y2);
+            
+            x += pos.x_advance;
+            y += pos.y_advance;
+            
+            pen_maxx = macro_max(pen_maxx, x);
+            pen_maxy = macro_max(pen_maxy, y);
+        }
+    };
+    // a run's glyphs and their extent
+    struct run_layout {
+        size_t first_glyph = 0;
+        size_t glyph_count = 0;
+        extent total;
+        // where the pen is when the run starts, and the subtitle's bounds up to the run's end
+        float pen_x = 0, pen_y = 0;
+        int minx, miny, maxx, maxy;
+    };
+    // what an edit does to one run: reshapes text [from, to) and keeps old glyphs [prefix_begin, prefix_end) before
+    // it and [suffix_begin, suffix_end) after it (SIZE_MAX when there's no old run to keep glyphs from)
+    struct run_edit {
+        run_span run;
+        uint32_t from, to;
+        size_t prefix_begin = SIZE_MAX, prefix_end = SIZE_MAX;
+        size_t suffix_begin = SIZE_MAX, suffix_end = SIZE_MAX;
+        size_t glyph_count = 0;
+    };
+    
+    render_context & ctx;
+    subtitle sub; // what gets drawn
+    std::vector<uint32_t> text;
+    std::vector<run_span> runs;
+    std::vector<run_layout> laid; // one per run
+    std::vector<extent> running; // per glyph: its run's extent up to and including it
+    std::vector<uint8_t> unsafe; // per glyph: harfbuzz's UNSAFE_TO_BREAK, so breaking before it changes the shaping
+    uint64_t reshaped = 0; // codepoints shaped by edits so far
+    
+    std::vector<run_span> fresh_spans;
+    std::vector<run_edit> edits;
+    subtitle piece; // the glyphs replacing the old ones
+    std::vector<uint8_t> piece_unsafe;
+    shaped_run window; // the last window shaped
+    
+    editable_subtitle(render_context & ctx, float size, int mode = 0) : ctx(ctx)
+    {
+        sub.mode = mode;
+        sub.size = size_from_pixels(size);
+        sub.minx = 0;
+        sub.miny = 0;
+        sub.maxx = -1000000;
+        sub.maxy = -1000000;
+        sub.initialized = ctx.initialized;
+    }
+    
+    void append(const uint32_t * codepoints, size_t count)
+    {
+        replace(text.size(), 0, codepoints, count);
+    }
+    void erase(size_t offset, size_t count)
+    {
+        replace(offset, count, nullptr, 0);
+    }
+    void assign(const uint32_t * codepoints, size_t count)
+    {
+        replace(0, text.size(), codepoints, count);
+    }
+    
+    // replaces the erased codepoints at offset with the inserted ones
+    void replace(size_t offset, size_t erased, const uint32_t * inserted, size_t count)
+    {
+        if(!ctx.initialized)
+            return;
+        offset = macro_min(offset, text.size());
+        erased = macro_min(erased, text.size() - offset);
+        text.erase(text.begin() + offset, text.begin() + offset + erased);
+        text.insert(text.begin() + offset, inserted, inserted + count);
+        long delta = long(count) - long(erased);
+        size_t edit_end = offset + count;
+        
+        // the run holding the codepoint before the edit is the first that can change, since the edit may continue it
+        size_t first = 0;
+        if(offset > 0)
+        {
+            first = std::upper_bound(runs.begin(), runs.end(), uint32_t(offset - 1), [](uint32_t at, const run_span & run)
+            {
+                return at < run.offset;
+            }) - runs.begin() - 1;
+        }
+        
+        // Segmentation only looks at the run it's in, so it can pick up at the edit in the state that run is in, and
+        // stop once it reaches an old run's start in the same state the old runs were in there. The new runs replace
+        // runs [first, old).
+        run_segmenter segmenter(ctx, sub.mode, fresh_spans);
+        if(offset > 0)
+        {
+            segmenter.font = runs[first].font;
+            segmenter.rotated = runs[first].rotated;
+            segmenter.start = runs[first].offset;
+        }
+        
+        size_t old = first; // the first old run that's kept
+        size_t end = text.size();
+        for(size_t i = offset; i < text.size(); i++)
+        {
+            if(i >= edit_end)
+            {
+                size_t old_i = i - delta;
+                while(old < runs.size() and runs[old].offset < old_i)
+                    old++;
+                // the first run starts at 0 because the text does, not because anything changed there
+                if(old > 0 and old < runs.size() and runs[old].offset == old_i
+                   and runs[old - 1].rotated == segmenter.rotated and runs[old - 1].font == segmenter.font)
+                {
+                    end = i;
+                    break;
+                }
+            }
+            segmenter.add(text[i], i);
+        }
+        if(end == text.size())
+            old = runs.size();
+        if(end > segmenter.start)
+            segmenter.finish(end);
+        
+        size_t low, high; // old runs [low, high) get new glyphs
+        plan_edits(first, old, offset, edit_end, delta, low, high);
+        size_t low_glyph = low < laid.size() ? laid[low].first_glyph : sub.glyphs.size();
+        size_t glyph_begin = low_glyph;
+        size_t glyph_end = high < laid.size() ? laid[high].first_glyph : sub.glyphs.size();
+        if(edits.size() and edits.front().prefix_end != SIZE_MAX)
+            glyph_begin = edits.front().prefix_end;
+        if(edits.size() and edits.back().suffix_begin != SIZE_MAX)
+            glyph_end = edits.back().suffix_begin;
+        
+        shape_edits(delta);
+        
+        runs.erase(runs.begin() + first, runs.begin() + old);
+        runs.insert(runs.begin() + first, fresh_spans.begin(), fresh_spans.end());
+        laid.erase(laid.begin() + first, laid.begin() + old);
+        laid.insert(laid.begin() + first, fresh_spans.size(), run_layout());
+        size_t kept = first + fresh_spans.size();
+        for(size_t r = kept; r < runs.size(); r++)
+            runs[r].offset += delta;
+        
+        // the new glyphs go where the old ones were; the ones after them only need their clusters moved
+        splice(sub.glyphs, glyph_begin, glyph_end, piece.glyphs);
+        splice(sub.fonts, glyph_begin, glyph_end, piece.fonts);
+        splice(sub.modes, glyph_begin, glyph_end, piece.modes);
+        splice(sub.positions, glyph_begin, glyph_end, piece.positions);
+        splice(sub.clusters, glyph_begin, glyph_end, piece.clusters);
+        splice(sub.breaks, glyph_begin, glyph_end, piece.breaks);
+        splice(sub.layers, glyph_begin, glyph_end, piece.layers);
+        splice(unsafe, glyph_begin, glyph_end, piece_unsafe);
+        running.erase(running.begin() + glyph_begin, running.begin() + glyph_end);
+        running.insert(running.begin() + glyph_begin, piece.glyphs.size(), extent());
+        size_t after = glyph_begin + piece.glyphs.size();
+        if(delta != 0)
+        {
+            for(size_t i = after; i < sub.clusters.size(); i++)
+                sub.clusters[i] += delta;
+        }
+        
+        size_t glyph = low_glyph;
+        for(size_t e = 0; e < edits.size(); e++)
+        {
+            laid[low + e].first_glyph = glyph;
+            laid[low + e].glyph_count = edits[e].glyph_count;
+            glyph += edits[e].glyph_count;
+        }
+        long glyph_delta = long(piece.glyphs.size()) - long(glyph_end - glyph_begin);
+        if(glyph_delta != 0)
+        {
+            for(size_t r = low + edits.size(); r < laid.size(); r++)
+                laid[r].first_glyph += glyph_delta;
+        }
+        
+        // a run's extent only changes from its first new glyph on; the old glyphs kept after the window are redone
+        // too, since the pen reaches them from somewhere else now
+        for(size_t e = 0; e < edits.size(); e++)
+        {
+            auto & layout = laid[low + e];
+            size_t from = (e == 0) ? glyph_begin : layout.first_glyph;
+            size_t to = layout.first_glyph + layout.glyph_count;
+            extent total = (from > layout.first_glyph) ? running[from - 1] : extent();
+            for(size_t g = from; g < to; g++)
+            {
+                total.add(sub.positions[g], sub.breaks[g]);
+                running[g] = total;
+            }
+            layout.total = total;
+        }
+        // bounds are for one line again; wrap again after editing to get lines
+        sub.line_starts.clear();
+        fold_bounds(low);
+    }
+    
+    // Works out what to reshape, as edits, one per run from the first to the last the edit window touches: runs
+    // [first, old) are being replaced by fresh_spans, and the window is the edited text plus harfbuzz's context on
+    // either side. A run keeps old glyphs before the window if it starts where an old run did with the same font and
+    // orientation, and after the window if it ends where an old run did; the window's ends move out to clusters that
+    // are safe to break at. The edits replace old runs [low, high).
+    void plan_edits(size_t first, size_t old, size_t offset, size_t edit_end, long delta, size_t & low, size_t & high)
+    {
+        edits.clear();
+        uint32_t window_start = offset > RELAYOUT_CONTEXT ? offset - RELAYOUT_CONTEXT : 0;
+        uint32_t window_end = macro_min(edit_end + RELAYOUT_CONTEXT, text.size());
+        
+        const auto & clusters = sub.clusters;
+        auto safe_at = [&](size_t glyph, size_t run_glyph)
+        {
+            return glyph == run_glyph or (clusters[glyph] != clusters[glyph - 1] and !unsafe[glyph]);
+        };
+        auto same_face = [](const run_span & a, const run_span & b)
+        {
+            return a.font == b.font and a.rotated == b.rotated;
+        };
+        // old glyphs of run r before the last safe cluster at or before at, which is before the edit
+        auto keep_prefix = [&](size_t r, uint32_t at, run_edit & edit)
+        {
+            size_t begin = laid[r].first_glyph;
+            size_t end = begin + laid[r].glyph_count;
+            size_t g = std::upper_bound(clusters.begin() + begin, clusters.begin() + end, at) - clusters.begin();
+            if(g > begin)
+                g--;
+            while(g > begin and !safe_at(g, begin))
+                g--;
+            edit.prefix_begin = begin;
+            edit.prefix_end = g;
+            edit.from = (g > begin) ? clusters[g] : edit.run.offset;
+        };
+        // old glyphs of run r from the first safe cluster at or after at (in the new text), which is after the edit
+        auto keep_suffix = [&](size_t r, uint32_t at, run_edit & edit)
+        {
+            size_t begin = laid[r].first_glyph;
+            size_t end = begin + laid[r].glyph_count;
+            size_t g = std::lower_bound(clusters.begin() + begin, clusters.begin() + end, uint32_t(at - delta)) - clusters.begin();
+            while(g < end and !safe_at(g, begin))
+                g++;
+            edit.suffix_begin = g;
+            edit.suffix_end = end;
+            edit.to = (g < end) ? clusters[g] + delta : edit.run.offset + edit.run.length;
+        };
+        
+        // old runs before the edit that reach into the window's context
+        low = first;
+        while(low > 0 and runs[low - 1].offset + runs[low - 1].length > window_start)
+            low--;
+        for(size_t r = low; r < first; r++)
+        {
+            run_edit edit;
+            edit.run = runs[r];
+            edit.to = edit.run.offset + edit.run.length;
+            keep_prefix(r, macro_max(edit.run.offset, window_start), edit);
+            edits.push_back(edit);
+        }
+        
+        for(size_t f = 0; f < fresh_spans.size(); f++)
+        {
+            run_edit edit;
+            edit.run = fresh_spans[f];
+            uint32_t run_end = edit.run.offset + edit.run.length;
+            edit.from = edit.run.offset;
+            edit.to = run_end;
+            if(f == 0 and first < old and runs[first].offset == edit.run.offset and same_face(runs[first], edit.run))
+                keep_prefix(first, macro_max(edit.run.offset, window_start), edit);
+            if(f + 1 == fresh_spans.size() and first < old and same_face(runs[old - 1], edit.run)
+               and runs[old - 1].offset + runs[old - 1].length + delta == run_end)
+                keep_suffix(old - 1, macro_max(edit.run.offset, macro_min(run_end, window_end)), edit);
+            edits.push_back(edit);
+        }
+        
+        // old runs after the edit that reach into the window's context
+        for(high = old; high < runs.size() and runs[high].offset + delta < window_end; high++)
+        {
+            size_t r = high;
+            run_edit edit;
+            edit.run = runs[r];
+            edit.run.offset += delta;
+            uint32_t run_end = edit.run.offset + edit.run.length;
+            edit.from = edit.run.offset;
+            keep_suffix(r, macro_min(run_end, window_end), edit);
+            edits.push_back(edit);
+        }
+    }
+    
+    // Builds piece, what replaces the old glyphs from the first edit's kept prefix to the last edit's kept suffix:
+    // each edit's window, shaped, with the kept glyphs of its run around it. Fills in the edits' glyph counts.
+    void shape_edits(long delta)
+    {
+        piece.glyphs.clear();
+        piece.fonts.clear();
+        piece.modes.clear();
+        piece.positions.clear();
+        piece.clusters.clear();
+        piece.breaks.clear();
+        piece.layers.clear();
+        piece_unsafe.clear();
+        
+        for(size_t e = 0; e < edits.size(); e++)
+        {
+            auto & edit = edits[e];
+            size_t before = piece.glyphs.size();
+            if(edit.from < edit.to)
+                shape_window(edit.run, edit.from, edit.to);
+            edit.glyph_count = piece.glyphs.size() - before;
+            // the first edit's prefix and the last edit's suffix stay where they are
+            if(edit.prefix_end != SIZE_MAX)
+            {
+                if(e > 0)
+                    keep_glyphs(edit.prefix_begin, edit.prefix_end, 0, before);
+                edit.glyph_count += edit.prefix_end - edit.prefix_begin;
+            }
+            if(edit.suffix_begin != SIZE_MAX)
+            {
+                if(e + 1 < edits.size())
+                    keep_glyphs(edit.suffix_begin, edit.suffix_end, delta, piece.glyphs.size());
+                edit.glyph_count += edit.suffix_end - edit.suffix_begin;
+            }
+        }
+    }
+    
+    // copies old glyphs [begin, end) into piece at at, moving their clusters along by delta
+    void keep_glyphs(size_t begin, size_t end, long delta, size_t at)
+    {
+        piece.glyphs.insert(piece.glyphs.begin() + at, sub.glyphs.begin() + begin, sub.glyphs.begin() + end);
+        piece.fonts.insert(piece.fonts.begin() + at, sub.fonts.begin() + begin, sub.fonts.begin() + end);
+        piece.modes.insert(piece.modes.begin() + at, sub.modes.begin() + begin, sub.modes.begin() + end);
+        piece.positions.insert(piece.positions.begin() + at, sub.positions.begin() + begin, sub.positions.begin() + end);
+        piece.clusters.insert(piece.clusters.begin() + at, sub.clusters.begin() + begin, sub.clusters.begin() + end);
+        piece.breaks.insert(piece.breaks.begin() + at, sub.breaks.begin() + begin, sub.breaks.begin() + end);
+        piece.layers.insert(piece.layers.begin() + at, sub.layers.begin() + begin, sub.layers.begin() + end);
+        piece_unsafe.insert(piece_unsafe.begin() + at, unsafe.begin() + begin, unsafe.begin() + end);
+        if(delta != 0)
+        {
+            for(size_t i = at; i < at + (end - begin); i++)
+                piece.clusters[i] += delta;
+        }
+    }
+    
+    // shapes text [from, to) of a run, with the rest of the text as context, onto the end of piece
+    void shape_window(const run_span & run, uint32_t from, uint32_t to)
+    {
+        auto font = ctx.fonts[run.font];
+        auto sized = font->get_size(sub.size);
+        if(!sized)
+            return;
+        
+        auto & state = ctx.scratch;
+        shape_span(state, run.font, *font, *sized, run_properties(ctx, run, sub.mode), text.data(), text.size(), from, to - from);
+        copy_shaped(state, window, 0, hb_buffer_get_length(state.buffer), from);
+        reshaped += to - from;
+        
+        unsigned int glyph_count;
+        hb_glyph_info_t * glyph_info = hb_buffer_get_glyph_infos(state.buffer, &glyph_count);
+        auto realmode = (run.rotated)?(2):(sub.mode);
+        for(size_t i = 0; i < window.glyphs.size(); ++i)
+        {
+            auto glyph_id = window.glyphs[i];
+            piece.glyphs.push_back(glyph_id);
+            piece.fonts.push_back(run.font);
+            piece.modes.push_back(realmode);
+            piece.clusters.push_back(window.clusters[i] + from);
+            piece.breaks.push_back(glyph_break_class(text.data(), text.size(), window, i, from));
+            piece.layers.push_back(0);
+            piece.positions.push_back(posdata(window.positions[i], font->box(*sized, glyph_id, realmode), realmode, piece.breaks.back()));
+            piece_unsafe.push_back(hb_glyph_info_get_glyph_flags(&glyph_info[i]) & HB_GLYPH_FLAG_UNSAFE_TO_BREAK ? 1 : 0);
+        }
+    }
+    
+    // Redoes the running pen and bounds from run r on. Advances are whole 64ths of a pixel, so adding up per-run sums
+    // lands on exactly the floats the subtitle constructor gets glyph by glyph, and the bounds come out the same.
+    void fold_bounds(size_t r)
+    {
+        float pen_x = 0, pen_y = 0;
+        int minx = 0, miny = 0, maxx = -1000000, maxy = -1000000;
+        if(r > 0 and r <= laid.size())
+        {
+            const auto & before = laid[r - 1];
+            pen_x = before.pen_x + before.total.x;
+            pen_y = before.pen_y + before.total.y;
+            minx = before.minx;
+            miny = before.miny;
+            maxx = before.maxx;
+            maxy = before.maxy;
+        }
+        for(; r < laid.size(); r++)
+        {
+            auto & layout = laid[r];
+            const auto & total = layout.total;
+            layout.pen_x = pen_x;
+            layout.pen_y = pen_y;
+            if(total.measured)
+            {
+                minx = macro_min(minx, floor(pen_x + total.ink_minx));
+                miny = macro_min(miny, floor(pen_y + total.ink_miny));
+                maxx = macro_max(maxx,  ceil(pen_x + total.ink_maxx));
+                maxy = macro_max(maxy,  ceil(pen_y + total.ink_maxy));
+                // the pen isn't rounded up, just cut to an int, same as in the subtitle constructor
+                maxx = macro_max(maxx, pen_x + total.pen_maxx);
+                maxy = macro_max(maxy, pen_y + total.pen_maxy);
+            }
+            layout.minx = minx;
+            layout.miny = miny;
+            layout.maxx = maxx;
+            layout.maxy = maxy;
+            pen_x += total.x;
+            pen_y += total.y;
+        }
+        sub.minx = minx;
+        sub.miny = miny;
+        sub.maxx = maxx;
+        sub.maxy = maxy;
+    }
+    
+    // replaces items [begin, end) with replacement
+    template<typename T>
+    static void splice(std::vector<T> & items, size_t begin, size_t end, const std::vector<T> & replacement)
+    {
+        if(end - begin == replacement.size())
+        {
+            std::copy(replacement.begin(), replacement.end(), items.begin() + begin);
+            return;
+        }
+        items.erase(items.begin() + begin, items.begin() + end);
+        items.insert(items.begin() + begin, replacement.begin(), replacement.end());
+    }
+};
@@ -42,14 +42,40 @@ void ensure_ordered(float & a, float & b)
         a = t;
     }
 }
+template<typename T>
+void swap(T & a, T & b)
+{
+    T t = a;
+    a = b;
+    b = t;
+}
+template<typename T>
+void rotate(T & a, T & b)
+{
+    swap(a, b);
+    b = -b;
+}
 struct sprite {
     pixel * buffer = nullptr;
     int w, h;
-    sprite(unsigned char * buffer, const int w, const int h)
+    bool owned = false; // buffer came from malloc and goes with the sprite
+    sprite(unsigned char * buffer, const int w, const int h, const bool owned = false)
     {
         this->w = w;
         this->h = h;
         this->buffer = (pixel *)buffer;
+        this->owned = owned;
+    }
+    ~sprite()
+    {
+        if(owned)
+            free(buffer);
+    }
+    sprite(const sprite &) = delete;
+    sprite & operator=(const sprite &) = delete;
+    size_t bytes() const
+    {
+        return sizeof(sprite) + (owned ? size_t(w)*h*sizeof(pixel) : 0);
     }
     pixel read(const int x, const int y) const
     {
@@ -134,7 +160,7 @@ struct sprite {
 sprite * sprite_from_mono(unsigned char * buffer, const int w, const int h)
 {
     unsigned char * newbuff = (unsigned char *)malloc(w*h*4);
-    auto image = new sprite(newbuff, w, h);
+    auto image = new sprite(newbuff, w, h, true);
     
     for(int y = 0; y <= h; y++)
     {
@@ -150,7 +176,7 @@ sprite * sprite_from_mono(unsigned char * buffer, const int w, const int h)
 sprite * rotated_sprite_from_mono(unsigned char * buffer, const int w, const int h)
 {
     unsigned char * newbuff = (unsigned char *)malloc(w*h*4);
-    auto image = new sprite(newbuff, h, w);
+    auto image = new sprite(newbuff, h, w, true);
     
     for(int y = 0; y <= h; y++)
     {
@@ -0,0 +1,151 @@
+#if defined(__SSE2__) or defined(_M_X64) or (defined(_M_IX86_FP) and _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SEGMENT_SSE2
+#endif
+
+// Builds runs one codepoint at a time; offsets are in whatever code units the text is in.
+struct run_segmenter {
+    render_context & ctx;
+    int mode;
+    std::vector<run_span> & spans;
+    bool rotated = false;
+    uint16_t font = 0;
+    size_t start = 0;
+    
+    run_segmenter(render_context & ctx, int mode, std::vector<run_span> & spans) : ctx(ctx), mode(mode), spans(spans)
+    {
+        spans.clear();
+    }
+    // the codepoint at offset
+    void add(uint32_t codepoint, size_t offset)
+    {
+        auto new_font = ctx.font_for(codepoint, font);
+        auto new_rotated = mode == 1 and ctx.fonts[new_font]->rotates(codepoint);
+        if(new_font != font or new_rotated != rotated)
+        {
+            if(offset > start)
+                spans.push_back({uint32_t(start), uint32_t(offset - start), rotated, font});
+            start = offset;
+            font = new_font;
+            rotated = new_rotated;
+        }
+    }
+    // whether a codepoint with this font and orientation would continue the current run
+    bool continues(bool range_rotated, size_t offset) const
+    {
+        return font == 0 and offset > start and range_rotated == rotated;
+    }
+    void finish(size_t end)
+    {
+        spans.push_back({uint32_t(start), uint32_t(end - start), rotated, font});
+    }
+};
+
+// Splits decoded text into runs. Codepoints inside the context's fast ranges are checked four at a time against the
+// ranges that agree with the current run, and only groups that leave them fall back to the per-codepoint lookup.
+void segment_runs(render_context & ctx, const uint32_t * text, size_t count, int mode, std::vector<run_span> & spans)
+{
+    run_segmenter segmenter(ctx, mode, spans);
+    if(count == 0)
+        return;
+    
+    auto & rotated = segmenter.rotated;
+    auto & font = segmenter.font;
+    auto & start = segmenter.start;
+    
+    size_t i = 0;
+#ifdef SEGMENT_SSE2
+    // biased bounds, since sse2 only has signed comparisons; each entry is {first, final} for a range of one class
+    struct biased_range {
+        __m128i first, final;
+    };
+    biased_range upright[8], sideways[8];
+    int upright_count = 0, sideways_count = 0;
+    const auto bias = _mm_set1_epi32(0x80000000);
+    for(const auto & range : ctx.fast_ranges)
+    {
+        biased_range biased = {_mm_set1_epi32(range.first ^ 0x80000000), _mm_set1_epi32(range.final ^ 0x80000000)};
+        // horizontal text never rotates, so every fast range counts as a match
+        if(range.rotated and mode == 1)
+            sideways[sideways_count++] = biased;
+        else
+            upright[upright_count++] = biased;
+    }
+    
+    for(; i + 4 <= count; i += 4)
+    {
+        if(font == 0 and i > start)
+        {
+            auto codepoints = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(text + i)), bias);
+            const auto ranges = rotated ? sideways : upright;
+            const int range_count = rotated ? sideways_count : upright_count;
+            auto inside = _mm_setzero_si128();
+            for(int r = 0; r < range_count; r++)
+            {
+                auto below = _mm_cmpgt_epi32(ranges[r].first, codepoints);
+                auto above = _mm_cmpgt_epi32(codepoints, ranges[r].final);
+                inside = _mm_or_si128(inside, _mm_andnot_si128(_mm_or_si128(below, above), _mm_set1_epi32(-1)));
+            }
+            // all four continue the current run
+            if(_mm_movemask_epi8(inside) == 0xFFFF)
+                continue;
+        }
+        for(size_t j = i; j < i + 4; j++)
+            segmenter.add(text[j], j);
+    }
+#endif
+    for(; i < count; i++)
+        segmenter.add(text[i], i);
+    
+    segmenter.finish(count);
+}
+
+// The same, straight from utf-8, with runs as byte spans. Bad sequences count as U+FFFD, like hb_buffer_add_utf8
+// treats them. Printable ascii is skipped sixteen bytes at a time while it continues the current run.
+void segment_runs(render_context & ctx, const uint8_t * text, size_t length, int mode, std::vector<run_span> & spans)
+{
+    run_segmenter segmenter(ctx, mode, spans);
+    if(length == 0)
+        return;
+    
+#ifdef SEGMENT_SSE2
+    // whether printable ascii is all one fast range, and if so, whether it's rotated
+    bool ascii_fast = false;
+    bool ascii_rotated = false;
+    for(const auto & range : ctx.fast_ranges)
+    {
+        if(range.first <= 0x20 and range.final >= 0x7E)
+        {
+            ascii_fast = true;
+            ascii_rotated = range.rotated and mode == 1;
+        }
+    }
+#endif
+    
+    size_t i = 0;
+    while(i < length)
+    {
+#ifdef SEGMENT_SSE2
+        if(ascii_fast and i + 16 <= length and segmenter.continues(ascii_rotated, i))
+        {
+            // signed compare: bytes 0x80 and up are negative, so they fail the lower bound
+            auto bytes = _mm_loadu_si128((const __m128i *)(text + i));
+            auto below = _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x20));
+            auto above = _mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x7E));
+            if(_mm_movemask_epi8(_mm_or_si128(below, above)) == 0)
+            {
+                i += 16;
+                continue;
+            }
+        }
+#endif
+        uint32_t codepoint = text[i];
+        size_t units = 1;
+        if(codepoint >= 0x80 and utf8_decode_one(text + i, i, length, &codepoint, &units) != 0)
+            codepoint = 0xFFFD;
+        segmenter.add(codepoint, i);
+        i += units;
+    }
+    
+    segmenter.finish(length);
+}
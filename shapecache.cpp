@@ -0,0 +1,91 @@
+// Shaped runs, remembered by their text and everything else that goes into shaping them. Subtitles repeat a lot
+// (names, interjections, lyrics), and a hit skips hb_shape entirely.
+// The key leaves out the surrounding text that goes along as context; it only changes the result for joining scripts.
+
+struct shape_key {
+    std::string text; // the run's code units
+    uint8_t unit_size; // 1: utf-8, 4: utf-32
+    hb_direction_t direction;
+    hb_script_t script;
+    hb_language_t language;
+    uint16_t font;
+    int32_t size;
+    bool operator==(const shape_key & other) const
+    {
+        return unit_size == other.unit_size and direction == other.direction and script == other.script
+           and language == other.language and font == other.font and size == other.size and text == other.text;
+    }
+};
+
+struct shape_key_hash {
+    size_t operator()(const shape_key & key) const
+    {
+        uint64_t fields[] = {key.unit_size, uint64_t(key.direction), uint64_t(key.script), uint64_t(uintptr_t(key.language)), key.font, uint64_t(uint32_t(key.size))};
+        return hash_bytes(key.text.data(), key.text.size(), hash_bytes(fields, sizeof(fields)));
+    }
+};
+
+// glyphs and positions as they came out of shaping (and the vert map), with clusters relative to the run's start
+struct shaped_run {
+    std::vector<hb_codepoint_t> glyphs;
+    std::vector<uint32_t> clusters;
+    std::vector<hb_glyph_position_t> positions;
+};
+
+// least recently used entries go first once there are more than capacity
+struct shape_cache {
+    typedef std::list<std::pair<shape_key, shaped_run>> entry_list;
+    entry_list entries; // most recently used first
+    std::unordered_map<shape_key, entry_list::iterator, shape_key_hash> index;
+    size_t capacity;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    
+    shape_cache(size_t capacity = 4096) : capacity(capacity)
+    {
+        
+    }
+    
+    const shaped_run * find(const shape_key & key)
+    {
+        auto found = index.find(key);
+        if(found == index.end())
+        {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        entries.splice(entries.begin(), entries, found->second);
+        return &found->second->second;
+    }
+    
+    // takes the run only if it's kept
+    const shaped_run * insert(shape_key && key, shaped_run && run)
+    {
+        if(capacity == 0)
+            return nullptr;
+        auto found = index.find(key);
+        if(found != index.end())
+        {
+            found->second->second = std::move(run);
+            entries.splice(entries.begin(), entries, found->second);
+            return &found->second->second;
+        }
+        while(entries.size() >= capacity)
+        {
+            index.erase(entries.back().first);
+            entries.pop_back();
+            evictions++;
+        }
+        entries.emplace_front(std::move(key), std::move(run));
+        index[entries.front().first] = entries.begin();
+        return &entries.front().second;
+    }
+    
+    void clear()
+    {
+        index.clear();
+        entries.clear();
+    }
+};
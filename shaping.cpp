@@ -0,0 +1,184 @@
+// Shaping a segmented line. Runs seen before come out of the shape cache. The rest are shaped with as few hb calls
+// as possible: in single-pass mode (the default), all the uncached runs with the same font and direction are shaped
+// together in one buffer spanning them, and the result is sliced back into runs by cluster. A slice is only used when
+// harfbuzz says the text is safe to break at both of its ends, which makes it the same as shaping the run on its own;
+// otherwise that run is shaped by itself.
+
+// hands a run to harfbuzz without copying or re-encoding the text
+void add_text(hb_buffer_t * buffer, const uint8_t * text, size_t length, uint32_t offset, uint32_t count)
+{
+    hb_buffer_add_utf8(buffer, (const char *)text, length, offset, count);
+}
+void add_text(hb_buffer_t * buffer, const uint32_t * text, size_t length, uint32_t offset, uint32_t count)
+{
+    hb_buffer_add_utf32(buffer, text, length, offset, count);
+}
+
+const hb_segment_properties_t & run_properties(const render_context & ctx, const run_span & run, int mode)
+{
+    return ctx.japanese[mode == 1 and !run.rotated];
+}
+
+template<typename T>
+void fill_shape_key(shape_key & key, const T * text, const run_span & run, const hb_segment_properties_t & props, int32_t size)
+{
+    key.text.assign((const char *)(text + run.offset), run.length*sizeof(T));
+    key.unit_size = sizeof(T);
+    key.direction = props.direction;
+    key.script = props.script;
+    key.language = props.language;
+    key.font = run.font;
+    key.size = size;
+}
+
+// shapes text[offset, offset + count) into the context's buffer, with the rest of the text as context
+template<typename T>
+void shape_span(shape_state & state, uint16_t which, render_font & font, sized_font & sized, const hb_segment_properties_t & props, const T * text, size_t length, uint32_t offset, uint32_t count)
+{
+    auto buffer = state.buffer;
+    hb_buffer_clear_contents(buffer);
+    add_text(buffer, text, length, offset, count);
+    hb_buffer_set_segment_properties(buffer, &props);
+    
+    /*
+    hb_feature_t features[] = {
+        { HB_TAG('v','e','r','t'), 1, 0, std::numeric_limits<unsigned int>::max() },
+        { HB_TAG('v','r','t','2'), 1, 0, std::numeric_limits<unsigned int>::max() },
+        { HB_TAG('v','k','r','n'), 1, 0, std::numeric_limits<unsigned int>::max() },
+        { HB_TAG('v','p','a','l'), 1, 0, std::numeric_limits<unsigned int>::max() },
+    };
+    */
+    
+    hb_shape_plan_execute(font.get_plan(props), state.font_for(which, sized), buffer, NULL, 0);
+    
+    if(HB_DIRECTION_IS_VERTICAL(props.direction) and font.vert_map.size())
+    {
+        unsigned int glyph_count;
+        hb_glyph_info_t *     glyph_info = hb_buffer_get_glyph_infos    (buffer, &glyph_count);
+        hb_glyph_position_t * glyph_pos  = hb_buffer_get_glyph_positions(buffer, &glyph_count);
+        font.apply_vert_map(sized, glyph_info, glyph_pos, glyph_count);
+    }
+}
+
+// copies glyphs [first, last) of the context's buffer out as a run starting at offset
+void copy_shaped(shape_state & state, shaped_run & out, unsigned int first, unsigned int last, uint32_t offset)
+{
+    unsigned int glyph_count;
+    hb_glyph_info_t *     glyph_info = hb_buffer_get_glyph_infos    (state.buffer, &glyph_count);
+    hb_glyph_position_t * glyph_pos  = hb_buffer_get_glyph_positions(state.buffer, &glyph_count);
+    out.glyphs.clear();
+    out.clusters.clear();
+    for(unsigned int i = first; i < last; ++i)
+    {
+        out.glyphs.push_back(glyph_info[i].codepoint);
+        out.clusters.push_back(glyph_info[i].cluster - offset);
+    }
+    out.positions.assign(glyph_pos + first, glyph_pos + last);
+}
+
+// Fills state.shaped[i] with state.runs[i] shaped. Entries point either into the state's shape cache or at its
+// fresh_runs, and stay valid until cache_line.
+template<typename T>
+void shape_line(render_context & ctx, shape_state & state, const T * text, size_t length, int mode, int32_t size)
+{
+    const auto & runs = state.runs;
+    auto & shaped = state.shaped;
+    auto & fresh = state.fresh_runs;
+    shaped.assign(runs.size(), nullptr);
+    if(fresh.size() < runs.size())
+        fresh.resize(runs.size());
+    
+    for(size_t r = 0; r < runs.size(); r++)
+    {
+        fill_shape_key(state.lookup, text, runs[r], run_properties(ctx, runs[r], mode), size);
+        shaped[r] = state.shapes->find(state.lookup);
+    }
+    
+    auto & group = state.run_group;
+    for(size_t r = 0; r < runs.size(); r++)
+    {
+        if(shaped[r])
+            continue;
+        const auto & props = run_properties(ctx, runs[r], mode);
+        auto font = ctx.fonts[runs[r].font];
+        auto sized = font->get_size(size);
+        if(!sized)
+        {
+            fresh[r] = shaped_run();
+            shaped[r] = &fresh[r];
+            continue;
+        }
+        
+        // every later uncached run that would be shaped the same way
+        group.clear();
+        group.push_back(r);
+        if(ctx.single_pass)
+        {
+            for(size_t other = r + 1; other < runs.size(); other++)
+            {
+                if(!shaped[other] and runs[other].font == runs[r].font and &run_properties(ctx, runs[other], mode) == &props)
+                    group.push_back(other);
+            }
+        }
+        
+        if(group.size() > 1)
+        {
+            const auto & last = runs[group.back()];
+            uint32_t span_end = last.offset + last.length;
+            shape_span(state, runs[r].font, *font, *sized, props, text, length, runs[r].offset, span_end - runs[r].offset);
+            
+            unsigned int glyph_count;
+            hb_glyph_info_t * glyph_info = hb_buffer_get_glyph_infos(state.buffer, &glyph_count);
+            auto safe_at = [&](unsigned int i)
+            {
+                return i == glyph_count or !(hb_glyph_info_get_glyph_flags(&glyph_info[i]) & HB_GLYPH_FLAG_UNSAFE_TO_BREAK);
+            };
+            
+            // clusters only go up in horizontal and vertical text, so each run is one stretch of glyphs
+            unsigned int i = 0;
+            for(auto member : group)
+            {
+                const auto & run = runs[member];
+                while(i < glyph_count and glyph_info[i].cluster < run.offset)
+                    i++;
+                unsigned int first = i;
+                while(i < glyph_count and glyph_info[i].cluster < run.offset + run.length)
+                    i++;
+                // the run has to start and end on cluster boundaries of its own, so nothing merged across its ends
+                uint32_t end = run.offset + run.length;
+                bool whole = first < i and glyph_info[first].cluster == run.offset and (i == glyph_count ? end == span_end : glyph_info[i].cluster == end);
+                if(whole and (first == 0 or safe_at(first)) and safe_at(i))
+                {
+                    copy_shaped(state, fresh[member], first, i, run.offset);
+                    shaped[member] = &fresh[member];
+                }
+            }
+        }
+        
+        // whatever couldn't be cut out of a shared buffer gets shaped on its own
+        for(auto member : group)
+        {
+            if(shaped[member])
+                continue;
+            const auto & run = runs[member];
+            shape_span(state, run.font, *font, *sized, props, text, length, run.offset, run.length);
+            copy_shaped(state, fresh[member], 0, hb_buffer_get_length(state.buffer), run.offset);
+            shaped[member] = &fresh[member];
+        }
+    }
+}
+
+// moves the runs shape_line had to shape into the state's shape cache; state.shaped is done with after this
+template<typename T>
+void cache_line(render_context & ctx, shape_state & state, const T * text, int mode, int32_t size)
+{
+    if(state.shapes->capacity == 0)
+        return;
+    for(size_t r = 0; r < state.runs.size(); r++)
+    {
+        if(state.shaped[r] != &state.fresh_runs[r])
+            continue;
+        fill_shape_key(state.lookup, text, state.runs[r], run_properties(ctx, state.runs[r], mode), size);
+        state.shapes->insert(shape_key(state.lookup), std::move(state.fresh_runs[r]));
+    }
+}
@@ -0,0 +1,205 @@
+#include <string.h>
+#include <random>
+
+// Startup snapshot: everything render_font::build_tables and orientation_data::load derive, written the first time a
+// font is opened and mapped in place on later runs. It's keyed by both the font and the orientation data, so a change
+// to either one rebuilds it, including the rotation bitset that depends on both. Bump SNAPSHOT_VERSION whenever a section's layout changes.
+
+#define SNAPSHOT_VERSION 3
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t section_count;
+    uint64_t font_hash;
+    uint64_t data_hash;
+    uint32_t glyph_count;
+    uint32_t reserved;
+};
+
+struct snapshot_section {
+    uint32_t tag;
+    uint32_t element_size;
+    uint64_t count;
+    uint64_t offset; // from the start of the file, 8-byte aligned
+};
+
+const char snapshot_magic[8] = {'V', 'J', 'S', 'N', 'A', 'P', 0, 0};
+
+uint64_t hash_font(hb_blob_t * blob)
+{
+    unsigned int size = 0;
+    auto data = (const uint8_t *)hb_blob_get_data(blob, &size);
+    uint64_t hash = hash_bytes(&size, sizeof(size));
+    if(size < 12)
+        return hash_bytes(data, size, hash);
+    // the table directory holds a checksum of every table, so it identifies the font without paging in the rest of it
+    size_t directory_size = 12 + 16*((data[4]<<8) | data[5]);
+    // collections keep their directories further in; just take the start of the file
+    if(memcmp(data, "ttcf", 4) == 0)
+        directory_size = 0x10000;
+    return hash_bytes(data, macro_min(directory_size, size), hash);
+}
+
+std::string snapshot_path(uint64_t font_hash, uint64_t data_hash)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "vertjp-%016llx.snap", (unsigned long long)hash_bytes(&data_hash, sizeof(data_hash), font_hash));
+    return name;
+}
+
+struct snapshot_reader {
+    const uint8_t * data;
+    size_t size;
+    const snapshot_section * sections;
+    uint32_t section_count;
+    
+    // checks that the section exists with the expected element size and lies entirely inside the file
+    template<typename T>
+    bool get(uint32_t tag, table_view<T> & out, uint64_t expected_count = -1)
+    {
+        for(uint32_t i = 0; i < section_count; i++)
+        {
+            const auto & section = sections[i];
+            if(section.tag != tag)
+                continue;
+            if(section.element_size != sizeof(T) or section.offset % 8 != 0 or section.offset > size)
+                return false;
+            if(section.count > (size - section.offset)/sizeof(T))
+                return false;
+            if(expected_count != uint64_t(-1) and section.count != expected_count)
+                return false;
+            out.view((const T *)(data + section.offset), section.count);
+            return true;
+        }
+        return false;
+    }
+};
+
+// orientations can be null for fallback fonts, which only need their own tables, and when the orientation data is compiled in
+bool load_snapshot(render_font & font, orientation_data * orientations, uint64_t data_hash)
+{
+    auto font_hash = hash_font(font.hbblob);
+    auto blob = blob_from_file(snapshot_path(font_hash, data_hash).data());
+    if(!blob)
+        return false;
+    
+    unsigned int size = 0;
+    auto data = (const uint8_t *)hb_blob_get_data(blob, &size);
+    auto header = (const snapshot_header *)data;
+    if(size < sizeof(snapshot_header)
+       or memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0
+       or header->version != SNAPSHOT_VERSION
+       or header->font_hash != font_hash
+       or header->data_hash != data_hash
+       or header->glyph_count != font.glyph_count
+       or header->section_count > (size - sizeof(snapshot_header))/sizeof(snapshot_section))
+    {
+        hb_blob_destroy(blob);
+        return false;
+    }
+    
+    snapshot_reader reader = {data, size, (const snapshot_section *)(data + sizeof(snapshot_header)), header->section_count};
+    
+    bool valid = reader.get(HB_TAG('v','e','r','t'), font.vert_glyphs, (font.glyph_count+63)/64)
+             and reader.get(HB_TAG('c','o','v','r'), font.coverage, 0x110000/64)
+             and reader.get(HB_TAG('m','e','t','r'), font.metrics, font.glyph_count)
+             and reader.get(HB_TAG('r','o','t','a'), font.rotation, 0x110000/64);
+    if(valid and orientations)
+        valid = reader.get(HB_TAG('o','b','l','k'), orientations->blocks, 0x110000/256)
+            and reader.get(HB_TAG('o','v','a','l'), orientations->values);
+    // the hashes only say what the snapshot was made from, not that it's intact, and get() indexes values by block
+    // without checking, so every block has to be a whole one inside values
+    if(valid and orientations)
+    {
+        auto & blocks = orientations->blocks;
+        size_t block_count = orientations->values.size/256;
+        valid = orientations->values.size % 256 == 0;
+        for(size_t i = 0; valid and i < blocks.size; i++)
+            valid = blocks[i] < block_count;
+    }
+    
+    if(!valid)
+    {
+        font.vert_glyphs.clear();
+        font.coverage.clear();
+        font.metrics.clear();
+        font.rotation.clear();
+        if(orientations)
+        {
+            orientations->blocks.clear();
+            orientations->values.clear();
+        }
+        hb_blob_destroy(blob);
+        return false;
+    }
+    
+    font.snapshot = blob;
+    if(orientations)
+        orientations->snapshot = hb_blob_reference(blob);
+    return true;
+}
+
+struct snapshot_writer {
+    std::vector<snapshot_section> sections;
+    std::vector<std::pair<const void *, size_t>> contents;
+    
+    template<typename T>
+    void add(uint32_t tag, const table_view<T> & table)
+    {
+        sections.push_back({tag, sizeof(T), table.size, 0});
+        contents.push_back({table.data, table.size*sizeof(T)});
+    }
+};
+
+// failing to save isn't an error; the next start just rebuilds the tables again
+void save_snapshot(const render_font & font, const orientation_data * orientations, uint64_t data_hash)
+{
+    snapshot_writer writer;
+    writer.add(HB_TAG('v','e','r','t'), font.vert_glyphs);
+    writer.add(HB_TAG('c','o','v','r'), font.coverage);
+    writer.add(HB_TAG('m','e','t','r'), font.metrics);
+    writer.add(HB_TAG('r','o','t','a'), font.rotation);
+    if(orientations)
+    {
+        writer.add(HB_TAG('o','b','l','k'), orientations->blocks);
+        writer.add(HB_TAG('o','v','a','l'), orientations->values);
+    }
+    
+    snapshot_header header = {};
+    memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.version = SNAPSHOT_VERSION;
+    header.section_count = writer.sections.size();
+    header.font_hash = hash_font(font.hbblob);
+    header.data_hash = data_hash;
+    header.glyph_count = font.glyph_count;
+    
+    uint64_t offset = sizeof(header) + writer.sections.size()*sizeof(snapshot_section);
+    for(auto & section : writer.sections)
+    {
+        offset = (offset+7)/8*8;
+        section.offset = offset;
+        offset += section.count*section.element_size;
+    }
+    
+    auto path = snapshot_path(header.font_hash, data_hash);
+    // written under a temporary name and renamed into place, so concurrently starting workers never see half a file
+    auto temp = path + "." + std::to_string(std::random_device()()) + ".tmp";
+    auto f = fopen(temp.data(), "wb");
+    if(!f)
+        return;
+    
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok and fwrite(writer.sections.data(), sizeof(snapshot_section), writer.sections.size(), f) == writer.sections.size();
+    const uint8_t zeros[8] = {};
+    for(size_t i = 0; ok and i < writer.sections.size(); i++)
+    {
+        auto padding = writer.sections[i].offset - ftell(f);
+        ok = fwrite(zeros, 1, padding, f) == padding;
+        ok = ok and fwrite(writer.contents[i].first, 1, writer.contents[i].second, f) == writer.contents[i].second;
+    }
+    ok = (fclose(f) == 0) and ok;
+    
+    if(!ok or rename(temp.data(), path.data()) != 0)
+        remove(temp.data());
+}
@@ -0,0 +1,235 @@
+#include "include/hb/hb-subset.h"
+
+// Preparation mode: cuts a font down to the codepoints a corpus actually uses, so that workers map and parse less.
+// The harfbuzz we build against can't subset GSUB (it would pass it through with stale glyph ids), so layout tables
+// are dropped and the vertical forms 'vert' would have produced are stored in a private VJvt table instead:
+// uint16 version, uint16 count, then count pairs of uint16 (horizontal glyph, vertical glyph), sorted, big-endian.
+
+// a corpus is either plain UTF-8 text, or (if it starts with "U+") a whitespace-separated list of U+XXXX and U+XXXX..YYYY
+bool read_corpus(const char * filename, hb_set_t * unicodes)
+{
+    mapped_file file;
+    if(!map_file(filename, file))
+        return false;
+    
+    bool ok = true;
+    if(file.size >= 2 and file.data[0] == 'U' and file.data[1] == '+')
+    {
+        std::string text((const char *)file.data, file.size);
+        // hex right after "U+" or ".." at i; sets ok to false if there isn't any, or it's past the last codepoint
+        auto parse_hex = [&](size_t & i) -> uint32_t
+        {
+            auto start = text.c_str() + i + 2;
+            char * end;
+            auto value = strtoul(start, &end, 16);
+            if(end == start or !isxdigit((unsigned char)*start) or value > 0x10FFFF)
+            {
+                ok = false;
+                return 0;
+            }
+            i = end - text.c_str();
+            return value;
+        };
+        size_t i = 0;
+        while(ok and (i = text.find("U+", i)) != std::string::npos)
+        {
+            uint32_t first = parse_hex(i);
+            uint32_t final = first;
+            if(ok and text.compare(i, 2, "..") == 0)
+                final = parse_hex(i);
+            if(ok)
+                hb_set_add_range(unicodes, first, final);
+        }
+    }
+    else
+    {
+        ok = utf8_iterate((const uint8_t *)file.data, file.size, [&](uint32_t codepoint) -> int
+        {
+            if(codepoint >= 0x20)
+                hb_set_add(unicodes, codepoint);
+            return 0;
+        }) == 0;
+    }
+    unmap_file(file);
+    return ok;
+}
+
+// the glyph a single codepoint shapes to on its own
+hb_codepoint_t shape_single(hb_font_t * hbfont, hb_buffer_t * buffer, uint32_t codepoint, hb_direction_t direction, const hb_feature_t * features, unsigned int feature_count)
+{
+    hb_buffer_clear_contents(buffer);
+    hb_buffer_add_utf32(buffer, &codepoint, 1, 0, 1);
+    hb_buffer_set_direction(buffer, direction);
+    hb_buffer_set_script(buffer, hb_script_from_string("Jpan", -1));
+    hb_buffer_set_language(buffer, hb_language_from_string("ja", -1));
+    hb_shape(hbfont, buffer, features, feature_count);
+    unsigned int glyph_count;
+    auto glyph_info = hb_buffer_get_glyph_infos(buffer, &glyph_count);
+    return (glyph_count == 1) ? glyph_info[0].codepoint : 0;
+}
+
+hb_blob_t * vert_map_table(const std::vector<std::pair<hb_codepoint_t, hb_codepoint_t>> & pairs)
+{
+    std::vector<uint8_t> data;
+    auto put16 = [&](uint16_t value)
+    {
+        data.push_back(value >> 8);
+        data.push_back(value & 0xFF);
+    };
+    put16(1);
+    put16(pairs.size());
+    for(const auto & pair : pairs)
+    {
+        put16(pair.first);
+        put16(pair.second);
+    }
+    auto copy = (char *)malloc(data.size());
+    memcpy(copy, data.data(), data.size());
+    return hb_blob_create(copy, data.size(), HB_MEMORY_MODE_WRITABLE, copy, free);
+}
+
+int subset_font(const char * fontfile, const char * corpusfile, const char * outfile)
+{
+    auto blob = blob_from_file(fontfile);
+    if(!blob)
+    {
+        fprintf(stderr, "failed to open font file\n");
+        return 1;
+    }
+    auto hbface = hb_face_create(blob, 0);
+    auto hbfont = hb_font_create(hbface);
+    hb_ot_font_set_funcs(hbfont);
+    hb_blob_destroy(blob);
+    
+    auto unicodes = hb_set_create();
+    if(!read_corpus(corpusfile, unicodes))
+    {
+        fprintf(stderr, "failed to read corpus (missing file, invalid utf-8 or a bad U+ list)\n");
+        hb_set_destroy(unicodes);
+        hb_font_destroy(hbfont);
+        hb_face_destroy(hbface);
+        return 1;
+    }
+    
+    // every glyph the corpus can reach: nominal glyphs and what 'vert' and 'vrt2' turn them into
+    std::vector<std::pair<hb_codepoint_t, hb_codepoint_t>> vert_pairs;
+    std::vector<hb_codepoint_t> kept {0};
+    auto buffer = hb_buffer_create();
+    hb_feature_t vrt2 = {HB_TAG('v','r','t','2'), 1, 0, (unsigned int)-1};
+    hb_codepoint_t codepoint = HB_SET_VALUE_INVALID;
+    while(hb_set_next(unicodes, &codepoint))
+    {
+        hb_codepoint_t glyph;
+        if(!hb_font_get_nominal_glyph(hbfont, codepoint, &glyph))
+            continue;
+        kept.push_back(glyph);
+        auto vertical = shape_single(hbfont, buffer, codepoint, HB_DIRECTION_TTB, nullptr, 0);
+        if(vertical and vertical != glyph)
+        {
+            vert_pairs.push_back({glyph, vertical});
+            kept.push_back(vertical);
+        }
+        auto rotated = shape_single(hbfont, buffer, codepoint, HB_DIRECTION_TTB, &vrt2, 1);
+        if(rotated)
+            kept.push_back(rotated);
+    }
+    hb_buffer_destroy(buffer);
+    std::sort(kept.begin(), kept.end());
+    kept.erase(std::unique(kept.begin(), kept.end()), kept.end());
+    
+    auto input = hb_subset_input_create_or_fail();
+    if(!input)
+    {
+        fprintf(stderr, "failed to set up subsetting\n");
+        hb_set_destroy(unicodes);
+        hb_font_destroy(hbfont);
+        hb_face_destroy(hbface);
+        return 1;
+    }
+    hb_set_union(hb_subset_input_unicode_set(input), unicodes);
+    for(auto glyph : kept)
+        hb_set_add(hb_subset_input_glyph_set(input), glyph);
+    hb_subset_input_set_drop_layout(input, true);
+    auto subset = hb_subset(hbface, input);
+    hb_subset_input_destroy(input);
+    
+    auto subsetblob = hb_face_reference_blob(subset);
+    hb_face_destroy(subset);
+    auto newface = hb_face_create(subsetblob, 0);
+    auto newfont = hb_font_create(newface);
+    hb_ot_font_set_funcs(newfont);
+    
+    // the subsetter renumbers kept glyphs in order; the pairs are only valid if it kept exactly what we asked for
+    auto new_id = [&](hb_codepoint_t glyph)
+    {
+        return hb_codepoint_t(std::lower_bound(kept.begin(), kept.end(), glyph) - kept.begin());
+    };
+    bool consistent = hb_face_get_glyph_count(newface) == kept.size();
+    codepoint = HB_SET_VALUE_INVALID;
+    while(consistent and hb_set_next(unicodes, &codepoint))
+    {
+        hb_codepoint_t glyph, newglyph;
+        if(hb_font_get_nominal_glyph(hbfont, codepoint, &glyph))
+            consistent = hb_font_get_nominal_glyph(newfont, codepoint, &newglyph) and newglyph == new_id(glyph);
+    }
+    hb_font_destroy(newfont);
+    if(!consistent)
+    {
+        fprintf(stderr, "subset kept unexpected glyphs; vertical forms can't be remapped\n");
+        hb_face_destroy(newface);
+        hb_blob_destroy(subsetblob);
+        hb_set_destroy(unicodes);
+        hb_font_destroy(hbfont);
+        hb_face_destroy(hbface);
+        return 1;
+    }
+    
+    // copy the subset's tables into a new font alongside the vertical form map
+    auto builder = hb_face_builder_create();
+    hb_tag_t tags[64];
+    unsigned int offset = 0, count;
+    do
+    {
+        count = sizeof(tags)/sizeof(tags[0]);
+        hb_face_get_table_tags(newface, offset, &count, tags);
+        for(unsigned int i = 0; i < count; i++)
+        {
+            auto table = hb_face_reference_table(newface, tags[i]);
+            hb_face_builder_add_table(builder, tags[i], table);
+            hb_blob_destroy(table);
+        }
+        offset += count;
+    } while(count == sizeof(tags)/sizeof(tags[0]));
+    
+    for(auto & pair : vert_pairs)
+        pair = {new_id(pair.first), new_id(pair.second)};
+    std::sort(vert_pairs.begin(), vert_pairs.end());
+    vert_pairs.erase(std::unique(vert_pairs.begin(), vert_pairs.end(), [](const auto & a, const auto & b)
+    {
+        return a.first == b.first;
+    }), vert_pairs.end());
+    auto verttable = vert_map_table(vert_pairs);
+    hb_face_builder_add_table(builder, VERT_MAP_TAG, verttable);
+    hb_blob_destroy(verttable);
+    
+    auto outblob = hb_face_reference_blob(builder);
+    unsigned int size = 0;
+    auto data = hb_blob_get_data(outblob, &size);
+    auto f = fopen(outfile, "wb");
+    bool ok = f and size and fwrite(data, 1, size, f) == size;
+    if(f)
+        ok = (fclose(f) == 0) and ok;
+    if(ok)
+        printf("kept %u codepoints, %zu glyphs and %zu vertical forms; wrote %u bytes\n", hb_set_get_population(unicodes), kept.size(), vert_pairs.size(), size);
+    else
+        fprintf(stderr, "failed to write subset font\n");
+    
+    hb_blob_destroy(outblob);
+    hb_face_destroy(builder);
+    hb_face_destroy(newface);
+    hb_blob_destroy(subsetblob);
+    hb_set_destroy(unicodes);
+    hb_font_destroy(hbfont);
+    hb_face_destroy(hbface);
+    return ok ? 0 : 1;
+}
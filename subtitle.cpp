@@ -0,0 +1,548 @@
+struct posdata {
+    float x, y, x2, y2, x_advance, y_advance;
+    float origin_x, origin_y; // where the glyph's own origin sits relative to the pen, y going down
+    posdata(const hb_glyph_position_t & pos, const glyph_box & box, int mode) // 0: horizontal, 1: vertical, 2: rotated
+    {
+        float x_offset = pos.x_offset/64.0;
+        float y_offset = pos.y_offset/64.0;
+        float x_advance = pos.x_advance/64.0;
+        float y_advance = pos.y_advance/64.0;
+        
+        if(mode == 2)
+        {
+            rotate(x_offset, y_offset);
+            rotate(x_advance, y_advance);
+        }
+        
+        origin_x =  x_offset;
+        origin_y = -y_offset;
+        x = origin_x + box.x;
+        y = origin_y - box.y;
+        x2 = x + box.w;
+        y2 = y + box.h;
+        this->x_advance =  x_advance;
+        this->y_advance = -y_advance;
+    }
+    // breaks: the glyph's BREAK_ flags; hard breaks (newlines) only end lines, so they don't move the pen
+    posdata(const hb_glyph_position_t & pos, const glyph_box & box, int mode, uint8_t breaks) : posdata(pos, box, mode)
+    {
+        if(breaks & BREAK_HARD)
+        {
+            x_advance = 0;
+            y_advance = 0;
+        }
+    }
+    // moves the glyph away from the pen
+    void move(float dx, float dy)
+    {
+        x += dx;
+        x2 += dx;
+        origin_x += dx;
+        y += dy;
+        y2 += dy;
+        origin_y += dy;
+    }
+};
+
+// where the pen ends up after a line of glyphs, and the box around their ink and the pen's path, in whole pixels
+struct text_extents {
+    float x = 0;
+    float y = 0;
+    int minx = 0;
+    int miny = 0;
+    int maxx = -1000000;
+    int maxy = -1000000;
+    
+    void add(const posdata & pos)
+    {
+        minx = macro_min(minx, floor(x + pos.x));
+        miny = macro_min(miny, floor(y + pos.y));
+        
+        maxx = macro_max(maxx,  ceil(x + pos.x2));
+        maxy = macro_max(maxy,  ceil(y + pos.y2));
+        
+        x += pos.x_advance;
+        y += pos.y_advance;
+        
+        maxx = macro_max(maxx, x);
+        maxy = macro_max(maxy, y);
+    }
+    // hard breaks aren't drawn, so they take up no room either
+    void add(const posdata & pos, uint8_t breaks)
+    {
+        if(!(breaks & BREAK_HARD))
+            add(pos);
+    }
+    int width() const
+    {
+        return macro_max(maxx - minx, 0);
+    }
+    int height() const
+    {
+        return macro_max(maxy - miny, 0);
+    }
+};
+
+// Lays text out as far as its extents and nothing further: advances come from shaping and ink boxes from the font's
+// metrics table, so no glyph is loaded or rasterized and nothing is kept. Same numbers as a subtitle's bounds.
+template<typename T>
+text_extents measure_text(render_context & ctx, shape_state & state, const T * text, size_t length, float size, int mode)
+{
+    text_extents extents;
+    int32_t size26 = size_from_pixels(size);
+    auto & runs = state.runs;
+    segment_runs(ctx, text, length, mode, runs);
+    shape_line(ctx, state, text, length, mode, size26);
+    for(size_t r = 0; r < runs.size(); r++)
+    {
+        auto font = ctx.fonts[runs[r].font];
+        auto sized = font->get_size(size26);
+        if(!sized)
+            continue;
+        auto realmode = (runs[r].rotated)?(2):(mode);
+        auto shaped = state.shaped[r];
+        for(size_t i = 0; i < shaped->glyphs.size(); ++i)
+        {
+            auto breaks = glyph_break_class(text, length, *shaped, i, runs[r].offset);
+            extents.add(posdata(shaped->positions[i], font->box(*sized, shaped->glyphs[i], realmode), realmode, breaks), breaks);
+        }
+    }
+    cache_line(ctx, state, text, mode, size26);
+    return extents;
+}
+text_extents measure_text(render_context & ctx, std::string_view text, float size, int mode = 0)
+{
+    if(!ctx.initialized)
+        return text_extents();
+    return measure_text(ctx, ctx.scratch, (const uint8_t *)text.data(), text.size(), size, mode);
+}
+text_extents measure_text(render_context & ctx, const uint32_t * codepoints, size_t count, float size, int mode = 0)
+{
+    if(!ctx.initialized)
+        return text_extents();
+    return measure_text(ctx, ctx.scratch, codepoints, count, size, mode);
+}
+
+// ruby (furigana): an annotation set small beside the base text it reads, to the right in vertical text and above in
+// horizontal text
+struct ruby_span {
+    uint32_t offset, length; // the base text it annotates, in the base text's code units
+    std::string_view text;
+};
+
+#define RUBY_SCALE 0.5 // ruby size, relative to the base text's
+#define RUBY_ASCENT 0.88 // how far the em box goes above the baseline in CJK fonts, in ems; horizontal ruby sits on it
+
+// A laid out line. Laying out only shapes and measures; glyphs are rasterized into the context's glyph cache the first
+// time they're drawn (or up front with load_glyphs).
+struct subtitle {
+    int initialized = false;
+    
+    std::vector<hb_codepoint_t> glyphs;
+    std::vector<uint16_t> fonts;
+    std::vector<uint8_t> modes; // per glyph: 0, 1, or 2 for rotated
+    std::vector<posdata> positions;
+    std::vector<uint32_t> clusters; // where each glyph came from in the source text
+    std::vector<uint8_t> breaks; // per glyph: BREAK_ flags of the codepoint its cluster starts with
+    std::vector<uint8_t> layers; // per glyph: 0 for the text itself, 1 for ruby
+    
+    std::vector<uint32_t> line_starts; // the first glyph of each line after the first, once wrapped
+    float line_pitch = 0; // from one line's pen line to the next
+    
+    int minx = 0;
+    int miny = 0;
+    int maxx = -1000000;
+    int maxy = -1000000;
+    int mode = 0;
+    int32_t size = 0; // 26.6 pixels
+    int32_t ruby_size = 0;
+    
+    subtitle()
+    {
+        
+    }
+    
+    // text is only read during construction; glyph clusters are byte offsets into it
+    subtitle(render_context & ctx, std::string_view text, float size, int mode = 0) // 0: LTR; 1: TTB
+    {
+        if(!ctx.initialized) return;
+        
+        layout(ctx, ctx.scratch, (const uint8_t *)text.data(), text.size(), size, mode);
+    }
+    
+    // already decoded text, e.g. from a utf8_stream; clusters are codepoint indexes
+    subtitle(render_context & ctx, const uint32_t * codepoints, size_t count, float size, int mode = 0)
+    {
+        if(!ctx.initialized) return;
+        
+        layout(ctx, ctx.scratch, codepoints, count, size, mode);
+    }
+    
+    // text with ruby, all in the one subtitle; spans go in order, and any that overlap an earlier one are left out
+    subtitle(render_context & ctx, std::string_view text, const std::vector<ruby_span> & ruby, float size, int mode = 0)
+    {
+        if(!ctx.initialized) return;
+        
+        layout(ctx, ctx.scratch, (const uint8_t *)text.data(), text.size(), size, mode);
+        add_ruby(ctx, ctx.scratch, ruby);
+    }
+    
+    int32_t glyph_size(size_t i) const
+    {
+        return layers[i] ? ruby_size : size;
+    }
+    
+    // Lays out utf-8 (uint8_t) or utf-32 (uint32_t) text, shaping each run straight out of it. Only reads from the
+    // context, so with a state per thread and the size preloaded, different subtitles can be laid out concurrently.
+    template<typename T>
+    void layout(render_context & ctx, shape_state & state, const T * text, size_t length, float size, int mode)
+    {
+        this->mode = mode;
+        this->size = size_from_pixels(size);
+        
+        // runs break wherever the font or (in vertical text) the orientation changes
+        auto & runs = state.runs;
+        segment_runs(ctx, text, length, mode, runs);
+        shape_line(ctx, state, text, length, mode, this->size);
+        auto & shaped_runs = state.shaped;
+        
+        text_extents extents;
+        
+        for(size_t r = 0; r < runs.size(); r++)
+        {
+            const auto & run = runs[r];
+            auto font = ctx.fonts[run.font];
+            auto sized = font->get_size(this->size);
+            if(!sized)
+                continue;
+            
+            auto realmode = (run.rotated)?(2):(mode);
+            auto shaped = shaped_runs[r];
+            
+            for(size_t i = 0; i < shaped->glyphs.size(); ++i)
+            {
+                auto & hb_pos = shaped->positions[i];
+                auto glyph_id = shaped->glyphs[i];
+                
+                glyphs.push_back(glyph_id);
+                fonts.push_back(run.font);
+                modes.push_back(realmode);
+                clusters.push_back(shaped->clusters[i] + run.offset);
+                breaks.push_back(glyph_break_class(text, length, *shaped, i, run.offset));
+                layers.push_back(0);
+                positions.push_back(posdata(hb_pos, font->box(*sized, glyph_id, realmode), realmode, breaks.back()));
+                extents.add(positions.back(), breaks.back());
+            }
+        }
+        minx = extents.minx;
+        miny = extents.miny;
+        maxx = extents.maxx;
+        maxy = extents.maxy;
+        cache_line(ctx, state, text, mode, this->size);
+        initialized = true;
+    }
+    
+    // Sets the annotations beside the laid out text. The base was already shaped by layout; the annotations are
+    // smaller, so they're shaped in a second shape_line pass of their own, all of them concatenated into one buffer.
+    // Each one's glyphs go in right after the last glyph of its base, placed relative to the pen there and without
+    // moving it; the base can't be broken across lines, so the ruby stays put when the text is wrapped.
+    void add_ruby(render_context & ctx, shape_state & state, const std::vector<ruby_span> & ruby)
+    {
+        if(ruby.empty() or !initialized)
+            return;
+        ruby_size = size_from_pixels(size/64.0*RUBY_SCALE);
+        
+        std::string annotations;
+        std::vector<size_t> first_run; // of each annotation, and one past the last
+        auto & runs = state.runs;
+        std::vector<run_span> spans;
+        runs.clear();
+        for(const auto & span : ruby)
+        {
+            first_run.push_back(runs.size());
+            segment_runs(ctx, (const uint8_t *)span.text.data(), span.text.size(), mode, spans);
+            for(auto run : spans)
+            {
+                run.offset += annotations.size();
+                runs.push_back(run);
+            }
+            annotations += span.text;
+        }
+        first_run.push_back(runs.size());
+        auto text = (const uint8_t *)annotations.data();
+        shape_line(ctx, state, text, annotations.size(), mode, ruby_size);
+        
+        subtitle merged;
+        float base_pixels = size/64.0;
+        float ruby_pixels = ruby_size/64.0;
+        float pen_x = 0, pen_y = 0;
+        float start_x = 0, start_y = 0; // pen where the current annotation's base starts
+        size_t next = 0; // annotation
+        uint32_t done = 0; // base text before here can't take another annotation
+        bool inside = false; // in the current annotation's base
+        for(size_t i = 0; i < glyphs.size(); i++)
+        {
+            // skip annotations that overlap the one before or that no glyph starts in
+            while(next < ruby.size() and !inside and (ruby[next].offset < done or clusters[i] >= ruby[next].offset + ruby[next].length))
+                next++;
+            bool starts = next < ruby.size() and !inside and clusters[i] >= ruby[next].offset;
+            if(starts)
+            {
+                inside = true;
+                start_x = pen_x;
+                start_y = pen_y;
+            }
+            
+            merged.glyphs.push_back(glyphs[i]);
+            merged.fonts.push_back(fonts[i]);
+            merged.modes.push_back(modes[i]);
+            merged.positions.push_back(positions[i]);
+            merged.clusters.push_back(clusters[i]);
+            merged.breaks.push_back((inside and !starts) ? BREAK_INSIDE : breaks[i]);
+            merged.layers.push_back(0);
+            pen_x += positions[i].x_advance;
+            pen_y += positions[i].y_advance;
+            
+            auto end = inside ? ruby[next].offset + ruby[next].length : 0;
+            if(!inside or (i + 1 < glyphs.size() and clusters[i + 1] < end))
+                continue;
+            
+            // the last glyph of the base: lay the annotation out on its own pen, then center it along the base
+            size_t glyph_start = merged.glyphs.size();
+            float ruby_x = 0, ruby_y = 0;
+            for(size_t r = first_run[next]; r < first_run[next + 1]; r++)
+            {
+                const auto & run = runs[r];
+                auto font = ctx.fonts[run.font];
+                auto sized = font->get_size(ruby_size);
+                if(!sized)
+                    continue;
+                auto realmode = (run.rotated)?(2):(mode);
+                auto shaped = state.shaped[r];
+                for(size_t g = 0; g < shaped->glyphs.size(); g++)
+                {
+                    auto pos = posdata(shaped->positions[g], font->box(*sized, shaped->glyphs[g], realmode), realmode);
+                    pos.move(ruby_x, ruby_y);
+                    ruby_x += pos.x_advance;
+                    ruby_y += pos.y_advance;
+                    pos.x_advance = 0;
+                    pos.y_advance = 0;
+                    merged.glyphs.push_back(shaped->glyphs[g]);
+                    merged.fonts.push_back(run.font);
+                    merged.modes.push_back(realmode);
+                    merged.positions.push_back(pos);
+                    merged.clusters.push_back(ruby[next].offset);
+                    merged.breaks.push_back(BREAK_INSIDE);
+                    merged.layers.push_back(1);
+                }
+            }
+            float dx, dy;
+            if(mode == 1)
+            {
+                dx = (base_pixels + ruby_pixels)/2;
+                dy = (pen_y - start_y - ruby_y)/2;
+            }
+            else
+            {
+                dx = (pen_x - start_x - ruby_x)/2;
+                dy = -base_pixels*RUBY_ASCENT - ruby_pixels*(1 - RUBY_ASCENT);
+            }
+            for(size_t g = glyph_start; g < merged.glyphs.size(); g++)
+                merged.positions[g].move(start_x + dx - pen_x, start_y + dy - pen_y);
+            
+            done = end;
+            inside = false;
+            next++;
+        }
+        cache_line(ctx, state, text, mode, ruby_size);
+        
+        glyphs.swap(merged.glyphs);
+        fonts.swap(merged.fonts);
+        modes.swap(merged.modes);
+        positions.swap(merged.positions);
+        clusters.swap(merged.clusters);
+        breaks.swap(merged.breaks);
+        layers.swap(merged.layers);
+        fit_bounds();
+    }
+    
+    // where line n's pen starts: vertical columns go right to left, horizontal lines top to bottom
+    void line_origin(size_t line, float & x, float & y) const
+    {
+        x = (mode == 1) ? -(line*line_pitch) : 0;
+        y = (mode == 1) ? 0 : line*line_pitch;
+    }
+    
+    // Breaks the laid out line into lines of at most max_length pixels along the text's direction (column height in
+    // vertical text), line_spacing ems apart, and redoes the bounds; 0 puts it back on one line. Greedy, and only
+    // reads advances and break classes, so rewrapping at another length doesn't reshape anything.
+    // A line breaks at the last place before the overflow that the rules allow: not inside a cluster or a latin word,
+    // not before a closing bracket, small kana or punctuation, not after an opening bracket, not between two
+    // ellipses or dashes, and not after a full stop or comma inside a word (3.14, example.com). Spaces, commas and
+    // full stops hang past the end rather than being pushed onto the next line.
+    // A line with nowhere allowed to break is broken at the overflow anyway, and a newline always ends its line.
+    void wrap(float max_length, float line_spacing = 1.5)
+    {
+        line_starts.clear();
+        line_pitch = size/64.0*line_spacing;
+        
+        if(max_length > 0)
+        {
+            float pen = 0;
+            float line_start = 0; // pen at the current line's start
+            size_t start = 0; // first glyph of the current line
+            size_t candidate = 0; // last allowed break in the current line, if past its start
+            float candidate_pen = 0;
+            uint8_t previous = 0; // class of the last cluster
+            uint8_t before = 0; // and of the one before that
+            
+            auto break_at = [&](size_t at, float at_pen)
+            {
+                line_starts.push_back(at);
+                start = at;
+                line_start = at_pen;
+            };
+            
+            for(size_t i = 0; i < glyphs.size(); i++)
+            {
+                auto here = breaks[i];
+                if(!(here & BREAK_INSIDE))
+                {
+                    if(i > start and (previous & BREAK_HARD))
+                        break_at(i, pen);
+                    else if(i > start and !(here & BREAK_NO_START) and !(previous & BREAK_NO_END)
+                            and !(here & previous & (BREAK_INSEPARABLE | BREAK_WORD))
+                            and !((previous & BREAK_INFIX) and (here & before & BREAK_WORD)))
+                    {
+                        candidate = i;
+                        candidate_pen = pen;
+                    }
+                }
+                
+                float advance = (mode == 1) ? positions[i].y_advance : positions[i].x_advance;
+                if(i > start and !(here & BREAK_HANG) and pen + advance - line_start > max_length)
+                {
+                    if(candidate > start)
+                        break_at(candidate, candidate_pen);
+                    else if(!(here & BREAK_INSIDE))
+                        break_at(i, pen);
+                }
+                
+                pen += advance;
+                if(!(here & BREAK_INSIDE))
+                {
+                    before = previous;
+                    previous = here;
+                }
+            }
+        }
+        
+        fit_bounds();
+    }
+    
+    // the bounds of every glyph, with the pen going back to each line's origin
+    void fit_bounds()
+    {
+        text_extents extents;
+        size_t line = 0;
+        for(size_t i = 0; i < glyphs.size(); i++)
+        {
+            if(line < line_starts.size() and line_starts[line] == i)
+                line_origin(++line, extents.x, extents.y);
+            extents.add(positions[i], breaks[i]);
+        }
+        minx = extents.minx;
+        miny = extents.miny;
+        maxx = extents.maxx;
+        maxy = extents.maxy;
+    }
+    
+    // Rasterizes now whatever glyphs (of the count starting at first) drawing would otherwise rasterize as it went.
+    // The cache can evict them again before the draw unless both happen in one frame; see glyph_table::begin_frame.
+    void load_glyphs(render_context & ctx, size_t first = 0, size_t count = SIZE_MAX) const
+    {
+        size_t last = macro_min(glyphs.size(), first + macro_min(count, glyphs.size()));
+        for(size_t i = first; i < last; i++)
+        {
+            if(!(breaks[i] & BREAK_HARD))
+                ctx.get_glyph(fonts[i], glyph_size(i), glyphs[i], modes[i]);
+        }
+    }
+};
+
+// draws a laid out subtitle with its bounding box's top left corner at x, y
+void draw_subtitle(render_context & ctx, const subtitle & sub, sprite & target, int x = 0, int y = 0)
+{
+    if(!sub.initialized or !ctx.initialized)
+        return;
+    
+    float pen_x = x - sub.minx;
+    float pen_y = y - sub.miny;
+    size_t line = 0;
+    
+    for(unsigned int i = 0; i < sub.glyphs.size(); i++)
+    {
+        if(line < sub.line_starts.size() and sub.line_starts[line] == i)
+        {
+            sub.line_origin(++line, pen_x, pen_y);
+            pen_x += x - sub.minx;
+            pen_y += y - sub.miny;
+        }
+        
+        // hard breaks have no advance, and are left out rather than drawn as whatever the font has for them
+        if(sub.breaks[i] & BREAK_HARD)
+            continue;
+        
+        auto glyph = ctx.get_glyph(sub.fonts[i], sub.glyph_size(i), sub.glyphs[i], sub.modes[i]);
+        const auto & pos = sub.positions[i];
+        
+        // placed by the bitmap's own offsets rather than the metrics box, since hinting can shift it by a pixel
+        if(glyph and glyph->image)
+        {
+            int posx = round(pen_x + pos.origin_x + glyph->x);
+            int posy = round(pen_y + pos.origin_y - glyph->y);
+            target.draw(posx, posy, glyph->image);
+        }
+        
+        pen_x += pos.x_advance;
+        pen_y += pos.y_advance;
+    }
+}
+
+// The bounds come from unhinted outlines, but glyphs are drawn where their hinted bitmaps land, which can be a pixel
+// further out; canvases get this much slack on every side so that the edge rows and columns aren't cut off.
+#define CANVAS_PADDING 1
+
+// renders a laid out subtitle to a png of its own size, plus the padding
+bool save_subtitle_png(render_context & ctx, const subtitle & sub, const char * filename)
+{
+    if(!sub.initialized or !ctx.initialized)
+        return false;
+    
+    int width  = sub.maxx - sub.minx;
+    int height = sub.maxy - sub.miny;
+    if(width <= 0 or height <= 0)
+        return false;
+    width  += CANVAS_PADDING*2;
+    height += CANVAS_PADDING*2;
+    
+    unsigned char * buffer = (unsigned char *)malloc(width*height*4);
+    sprite image(buffer, width, height);
+    
+    image.clear();
+    draw_subtitle(ctx, sub, image, CANVAS_PADDING, CANVAS_PADDING);
+    
+    // a short write (a full disk, say) sets the stream's error flag, which is checked once at the end
+    auto f = fopen(filename, "wb");
+    bool ok = f != nullptr;
+    if(f)
+    {
+        ok = stbi_write_png_to_func([](void * file, void * data, int size){
+            fwrite(data, 1, size, (FILE *) file);
+        }, f, width, height, 4, image.buffer, width*4) != 0;
+        ok = !ferror(f) and ok;
+        ok = (fclose(f) == 0) and ok;
+    }
+    free(buffer);
+    return ok;
+}